@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QLoggingCategory>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <memory>
+
+#include "../../src/adatabase.h"
+#include "../../src/aresult.h"
+#include "../../src/apg.h"
+
+using namespace ASql;
+
+/*
+ * Sends multi-MB bytea and text parameters and checks they come back intact.
+ *
+ * While the parameters are being written the event loop must keep running, a timer
+ * counts how many times it fired, if the send path blocked it stays close to zero
+ * and the demo exits with 1.
+ * To make the socket slow enough to see the difference, run against a throttled
+ * link, e.g. "tc qdisc add dev lo root tbf rate 8mbit burst 32kbit latency 400ms".
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const int size = argc > 2 ? QByteArray(argv[2]).toInt() : 16 * 1024 * 1024;
+    ADatabase db(APg::factory(argc > 1 ? QString::fromLocal8Bit(argv[1]) : QStringLiteral("postgres:///")));
+    db.open();
+
+    QByteArray blob(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        blob[i] = char((i * 7 + i / 251) & 0xff);
+    }
+    const QByteArray blobMd5 = QCryptographicHash::hash(blob, QCryptographicHash::Md5).toHex();
+
+    const QString text = QString(size / 8, QLatin1Char('x')) + QStringLiteral("ção");
+    const QByteArray textMd5 = QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Md5).toHex();
+
+    auto ticks = std::make_shared<int>(0);
+    auto ticker = new QTimer(&app);
+    ticker->setInterval(5);
+    QObject::connect(ticker, &QTimer::timeout, [ticks] { ++(*ticks); });
+    ticker->start();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto failed = std::make_shared<bool>(false);
+    auto pending = std::make_shared<int>(2);
+    auto finished = [failed, pending, ticks, ticker, timer] {
+        if (--(*pending) == 0) {
+            // A loop that kept running fires about once per interval, allow for a busy machine
+            const qint64 elapsed = timer.elapsed();
+            const qint64 expected = elapsed / ticker->interval() / 4;
+            qDebug() << "event loop ticks while sending" << *ticks << "in" << elapsed << "ms, expected at least" << expected;
+            if (*ticks < expected) {
+                qCritical() << "event loop was blocked while sending";
+                *failed = true;
+            }
+            qApp->exit(*failed ? 1 : 0);
+        }
+    };
+
+    // The server hashes the value so only the parameter is big, not the result
+    db.exec(QStringLiteral("SELECT md5($1::bytea), length($1::bytea)"), {blob},
+            [=] (AResult &result) {
+        if (result.error()) {
+            qCritical() << "bytea error" << result.errorString();
+            *failed = true;
+        } else if (result[0][0].toString().toLatin1() != blobMd5 || result[0][1].toInt() != size) {
+            qCritical() << "bytea mismatch" << result[0][0].toString() << blobMd5 << result[0][1].toInt() << size;
+            *failed = true;
+        } else {
+            qDebug() << "bytea round trip OK" << size << "bytes in" << timer.elapsed() << "ms";
+        }
+        finished();
+    });
+
+    // A second query queued behind the big one must still be answered in order
+    db.exec(QStringLiteral("SELECT md5(convert_to($1::text, 'UTF8')), $1::text"), {text},
+            [=] (AResult &result) {
+        if (result.error()) {
+            qCritical() << "text error" << result.errorString();
+            *failed = true;
+        } else if (result[0][0].toString().toLatin1() != textMd5 || result[0][1].toString() != text) {
+            qCritical() << "text mismatch" << result[0][0].toString() << textMd5;
+            *failed = true;
+        } else {
+            qDebug() << "text round trip OK" << text.size() << "chars in" << timer.elapsed() << "ms";
+        }
+        finished();
+    });
+
+    return app.exec();
+}
@@ -0,0 +1,674 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aarrowwriter.h"
+
+#include <QDateTime>
+#include <QIODevice>
+#include <QVector>
+#include <QtEndian>
+#include <QLoggingCategory>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+Q_LOGGING_CATEGORY(ASQL_ARROW, "asql.arrow", QtInfoMsg)
+
+using namespace ASql;
+
+namespace {
+
+// Values from the Arrow Schema.fbs and Message.fbs definitions
+enum ArrowType : quint8 {
+    ArrowTypeInt = 2,
+    ArrowTypeFloatingPoint = 3,
+    ArrowTypeBinary = 4,
+    ArrowTypeUtf8 = 5,
+    ArrowTypeBool = 6,
+    ArrowTypeDate = 8,
+    ArrowTypeTime = 9,
+    ArrowTypeTimestamp = 10,
+};
+
+enum ArrowMessageHeader : quint8 {
+    ArrowHeaderSchema = 1,
+    ArrowHeaderRecordBatch = 3,
+};
+
+constexpr quint64 ArrowMetadataV5 = 4;
+constexpr quint64 ArrowPrecisionSingle = 1;
+constexpr quint64 ArrowPrecisionDouble = 2;
+constexpr quint64 ArrowDateUnitDay = 0;
+constexpr quint64 ArrowTimeUnitMillisecond = 1;
+
+/*
+ * A minimal flatbuffers encoder, objects are written front to back
+ * and offsets to child objects are patched once the child is written,
+ * as flatbuffers offsets always point forward.
+ */
+class AFlatBuilder
+{
+public:
+    using Writer = std::function<int(AFlatBuilder &)>;
+
+    struct Field {
+        int id;
+        int size;
+        quint64 value;
+        Writer child;
+    };
+
+    static Field scalar(int id, int size, quint64 value) { return { id, size, value, {} }; }
+    static Field offset(int id, const Writer &child) { return { id, 4, 0, child }; }
+
+    int table(QVector<Field> fields);
+    int string(const QByteArray &str);
+    int tableVector(const QVector<Writer> &tables);
+    int structVector(const QVector<qint64> &values);
+    QByteArray finish(const Writer &root);
+
+private:
+    template <typename T>
+    inline void put(T value) {
+        value = qToLittleEndian(value);
+        m_buf.append(reinterpret_cast<const char *>(&value), int(sizeof(T)));
+    }
+    void putSized(int size, quint64 value);
+    void pad(int alignment, int remainder = 0);
+    void patch(int at, int target);
+
+    QByteArray m_buf;
+};
+
+void AFlatBuilder::putSized(int size, quint64 value)
+{
+    switch (size) {
+    case 1:
+        put<quint8>(quint8(value));
+        break;
+    case 2:
+        put<quint16>(quint16(value));
+        break;
+    case 4:
+        put<quint32>(quint32(value));
+        break;
+    default:
+        put<quint64>(value);
+    }
+}
+
+void AFlatBuilder::pad(int alignment, int remainder)
+{
+    while (m_buf.size() % alignment != remainder) {
+        m_buf.append('\0');
+    }
+}
+
+void AFlatBuilder::patch(int at, int target)
+{
+    const quint32 value = qToLittleEndian(quint32(target - at));
+    memcpy(m_buf.data() + at, &value, sizeof(quint32));
+}
+
+int AFlatBuilder::table(QVector<Field> fields)
+{
+    // Larger fields first, so that each one is naturally aligned
+    std::stable_sort(fields.begin(), fields.end(), [] (const Field &a, const Field &b) {
+        return a.size > b.size;
+    });
+
+    int maxId = -1;
+    for (const Field &field : fields) {
+        maxId = qMax(maxId, field.id);
+    }
+
+    QVector<quint16> vtable(maxId + 1, 0);
+    int tableSize = int(sizeof(qint32));
+    for (const Field &field : fields) {
+        vtable[field.id] = quint16(tableSize);
+        tableSize += field.size;
+    }
+
+    pad(2);
+    const int vtablePos = m_buf.size();
+    put<quint16>(quint16(4 + 2 * vtable.size()));
+    put<quint16>(quint16(tableSize));
+    for (quint16 fieldOffset : vtable) {
+        put<quint16>(fieldOffset);
+    }
+
+    // Fields start right after the vtable offset and must be 8 bytes aligned
+    pad(8, 4);
+    const int tablePos = m_buf.size();
+    put<qint32>(tablePos - vtablePos);
+
+    QVector<QPair<int, Writer>> children;
+    for (const Field &field : fields) {
+        if (field.child) {
+            children.append({ m_buf.size(), field.child });
+        }
+        putSized(field.size, field.value);
+    }
+
+    for (const auto &child : children) {
+        patch(child.first, child.second(*this));
+    }
+
+    return tablePos;
+}
+
+int AFlatBuilder::string(const QByteArray &str)
+{
+    pad(4);
+    const int pos = m_buf.size();
+    put<quint32>(quint32(str.size()));
+    m_buf.append(str);
+    m_buf.append('\0');
+    return pos;
+}
+
+int AFlatBuilder::tableVector(const QVector<Writer> &tables)
+{
+    pad(4);
+    const int pos = m_buf.size();
+    put<quint32>(quint32(tables.size()));
+    for (int i = 0; i < tables.size(); ++i) {
+        put<quint32>(0);
+    }
+
+    for (int i = 0; i < tables.size(); ++i) {
+        patch(pos + 4 + 4 * i, tables[i](*this));
+    }
+    return pos;
+}
+
+int AFlatBuilder::structVector(const QVector<qint64> &values)
+{
+    // Both FieldNode and Buffer structs are a pair of longs
+    pad(8, 4);
+    const int pos = m_buf.size();
+    put<quint32>(quint32(values.size() / 2));
+    for (qint64 value : values) {
+        put<qint64>(value);
+    }
+    return pos;
+}
+
+QByteArray AFlatBuilder::finish(const Writer &root)
+{
+    m_buf.clear();
+    put<quint32>(0);
+    patch(0, root(*this));
+    pad(8);
+    return m_buf;
+}
+
+AFlatBuilder::Writer arrowTypeWriter(int type, bool timeZone, quint8 &arrowType)
+{
+    auto intType = [] (quint64 bitWidth, bool isSigned) -> AFlatBuilder::Writer {
+        return [=] (AFlatBuilder &b) {
+            return b.table({ AFlatBuilder::scalar(0, 4, bitWidth), AFlatBuilder::scalar(1, 1, isSigned) });
+        };
+    };
+    auto emptyType = [] (AFlatBuilder &b) {
+        return b.table({});
+    };
+
+    switch (type) {
+    case QMetaType::Bool:
+        arrowType = ArrowTypeBool;
+        return emptyType;
+    case QMetaType::Short:
+        arrowType = ArrowTypeInt;
+        return intType(16, true);
+    case QMetaType::Int:
+        arrowType = ArrowTypeInt;
+        return intType(32, true);
+    case QMetaType::UInt:
+        arrowType = ArrowTypeInt;
+        return intType(32, false);
+    case QMetaType::LongLong:
+        arrowType = ArrowTypeInt;
+        return intType(64, true);
+    case QMetaType::ULongLong:
+        arrowType = ArrowTypeInt;
+        return intType(64, false);
+    case QMetaType::Float:
+    case QMetaType::Double:
+    {
+        arrowType = ArrowTypeFloatingPoint;
+        const quint64 precision = type == QMetaType::Float ? ArrowPrecisionSingle : ArrowPrecisionDouble;
+        return [=] (AFlatBuilder &b) {
+            return b.table({ AFlatBuilder::scalar(0, 2, precision) });
+        };
+    }
+    case QMetaType::QDate:
+        arrowType = ArrowTypeDate;
+        return [] (AFlatBuilder &b) {
+            return b.table({ AFlatBuilder::scalar(0, 2, ArrowDateUnitDay) });
+        };
+    case QMetaType::QTime:
+        // QTime has millisecond precision
+        arrowType = ArrowTypeTime;
+        return [] (AFlatBuilder &b) {
+            return b.table({ AFlatBuilder::scalar(0, 2, ArrowTimeUnitMillisecond), AFlatBuilder::scalar(1, 4, 32) });
+        };
+    case QMetaType::QDateTime:
+        arrowType = ArrowTypeTimestamp;
+        if (!timeZone) {
+            // Without a timezone the values are wall clock times
+            return [] (AFlatBuilder &b) {
+                return b.table({ AFlatBuilder::scalar(0, 2, ArrowTimeUnitMillisecond) });
+            };
+        }
+        return [] (AFlatBuilder &b) {
+            return b.table({
+                               AFlatBuilder::scalar(0, 2, ArrowTimeUnitMillisecond),
+                               AFlatBuilder::offset(1, [] (AFlatBuilder &b) {
+                                   return b.string(QByteArrayLiteral("UTC"));
+                               }),
+                           });
+        };
+    case QMetaType::QByteArray:
+        arrowType = ArrowTypeBinary;
+        return emptyType;
+    default:
+        arrowType = ArrowTypeUtf8;
+        return emptyType;
+    }
+}
+
+QByteArray arrowMessage(quint8 headerType, const AFlatBuilder::Writer &header, qint64 bodyLength)
+{
+    AFlatBuilder builder;
+    return builder.finish([=] (AFlatBuilder &b) {
+        return b.table({
+                           AFlatBuilder::scalar(0, 2, ArrowMetadataV5),
+                           AFlatBuilder::scalar(1, 1, headerType),
+                           AFlatBuilder::offset(2, header),
+                           AFlatBuilder::scalar(3, 8, quint64(bodyLength)),
+                       });
+    });
+}
+
+template <typename T>
+inline void appendLE(QByteArray &data, T value)
+{
+    value = qToLittleEndian(value);
+    data.append(reinterpret_cast<const char *>(&value), int(sizeof(T)));
+}
+
+inline bool isVariableSize(int type)
+{
+    switch (type) {
+    case QMetaType::Bool:
+    case QMetaType::Short:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Float:
+    case QMetaType::Double:
+    case QMetaType::QDate:
+    case QMetaType::QTime:
+    case QMetaType::QDateTime:
+        return false;
+    default:
+        // Binary or Utf8
+        return true;
+    }
+}
+
+inline void padBody(QByteArray &body)
+{
+    while (body.size() % 8) {
+        body.append('\0');
+    }
+}
+
+}
+
+namespace ASql {
+
+class AArrowWriterPrivate
+{
+public:
+    bool write(const QByteArray &data);
+    bool writeSchema(const AResult &result);
+    bool writeBatch();
+    bool encodeColumn(int column, QVector<qint64> &nodes, QVector<qint64> &buffers, QByteArray &body);
+    void setError(const QString &error);
+
+    QIODevice *device;
+    QVector<AResult> pending;
+    QStringList names;
+    QVector<int> types;
+    QVector<bool> timeZones;
+    QString errorString;
+    qint64 pendingRows = 0;
+    int batchRows;
+    bool schemaWritten = false;
+    bool finished = false;
+};
+
+}
+
+bool AArrowWriterPrivate::write(const QByteArray &data)
+{
+    if (device->write(data) != data.size()) {
+        setError(QLatin1String("Failed to write Arrow stream: ") + device->errorString());
+        return false;
+    }
+    return true;
+}
+
+bool AArrowWriterPrivate::writeSchema(const AResult &result)
+{
+    const int columns = result.fields();
+    if (columns == 0) {
+        setError(QStringLiteral("Result has no columns"));
+        return false;
+    }
+
+    names = result.columnNames();
+    types.resize(columns);
+    timeZones.fill(true, columns);
+    for (int i = 0; i < columns; ++i) {
+        types[i] = result.columnType(i);
+        if (types[i] != QMetaType::QDateTime) {
+            continue;
+        }
+
+        // Date times in local time, like timestamp without time zone, carry no timezone
+        for (const auto &row : result) {
+            const QDateTime dateTime = row[i].toDateTime();
+            if (dateTime.isValid()) {
+                timeZones[i] = dateTime.timeSpec() != Qt::LocalTime;
+                break;
+            }
+        }
+    }
+
+    QVector<AFlatBuilder::Writer> fields;
+    for (int i = 0; i < columns; ++i) {
+        quint8 arrowType;
+        const AFlatBuilder::Writer typeWriter = arrowTypeWriter(types[i], timeZones[i], arrowType);
+        const QByteArray name = names[i].toUtf8();
+        fields.append([=] (AFlatBuilder &b) {
+            return b.table({
+                               AFlatBuilder::offset(0, [=] (AFlatBuilder &b) { return b.string(name); }),
+                               AFlatBuilder::scalar(1, 1, true),
+                               AFlatBuilder::scalar(2, 1, arrowType),
+                               AFlatBuilder::offset(3, typeWriter),
+                               AFlatBuilder::offset(5, [] (AFlatBuilder &b) { return b.tableVector({}); }),
+                           });
+        });
+    }
+
+    const QByteArray metadata = arrowMessage(ArrowHeaderSchema, [=] (AFlatBuilder &b) {
+        return b.table({
+                           AFlatBuilder::scalar(0, 2, 0), // Little endian
+                           AFlatBuilder::offset(1, [=] (AFlatBuilder &b) { return b.tableVector(fields); }),
+                       });
+    }, 0);
+
+    QByteArray message;
+    appendLE<quint32>(message, 0xFFFFFFFF);
+    appendLE<qint32>(message, metadata.size());
+    message.append(metadata);
+
+    schemaWritten = true;
+    return write(message);
+}
+
+bool AArrowWriterPrivate::encodeColumn(int column, QVector<qint64> &nodes, QVector<qint64> &buffers, QByteArray &body)
+{
+    const int type = types[column];
+    const bool timeZone = timeZones[column];
+    const bool variableSize = isVariableSize(type);
+
+    QByteArray validity(int((pendingRows + 7) / 8), '\0');
+    QByteArray offsets;
+    QByteArray data;
+    if (type == QMetaType::Bool) {
+        data.fill('\0', validity.size());
+    } else if (variableSize) {
+        offsets.reserve(int((pendingRows + 1) * 4));
+        appendLE<qint32>(offsets, 0);
+    }
+
+    static const QDate epoch(1970, 1, 1);
+    qint64 nullCount = 0;
+    qint64 row = 0;
+    for (const AResult &result : qAsConst(pending)) {
+        const int rows = result.size();
+        for (int r = 0; r < rows; ++r, ++row) {
+            const AResult::AColumn cell = result[r][column];
+            bool valid = !cell.isNull();
+            switch (type) {
+            case QMetaType::Bool:
+                if (valid && cell.toBool()) {
+                    data[int(row / 8)] = char(data[int(row / 8)] | (1 << (row % 8)));
+                }
+                break;
+            case QMetaType::Short:
+                appendLE<qint16>(data, valid ? qint16(cell.toInt()) : 0);
+                break;
+            case QMetaType::Int:
+                appendLE<qint32>(data, valid ? cell.toInt() : 0);
+                break;
+            case QMetaType::UInt:
+                appendLE<quint32>(data, valid ? quint32(cell.toULongLong()) : 0);
+                break;
+            case QMetaType::LongLong:
+                appendLE<qint64>(data, valid ? cell.toLongLong() : 0);
+                break;
+            case QMetaType::ULongLong:
+                appendLE<quint64>(data, valid ? cell.toULongLong() : 0);
+                break;
+            case QMetaType::Float:
+            {
+                const float value = valid ? float(cell.toDouble()) : 0;
+                quint32 bits;
+                memcpy(&bits, &value, sizeof(bits));
+                appendLE<quint32>(data, bits);
+                break;
+            }
+            case QMetaType::Double:
+            {
+                const double value = valid ? cell.toDouble() : 0;
+                quint64 bits;
+                memcpy(&bits, &value, sizeof(bits));
+                appendLE<quint64>(data, bits);
+                break;
+            }
+            case QMetaType::QDate:
+            {
+                const QDate date = valid ? cell.toDate() : QDate();
+                valid = date.isValid();
+                appendLE<qint32>(data, valid ? qint32(epoch.daysTo(date)) : 0);
+                break;
+            }
+            case QMetaType::QTime:
+            {
+                const QTime time = valid ? cell.toTime() : QTime();
+                valid = time.isValid();
+                appendLE<qint32>(data, valid ? time.msecsSinceStartOfDay() : 0);
+                break;
+            }
+            case QMetaType::QDateTime:
+            {
+                // infinity and other special values are not valid date times
+                QDateTime dateTime = valid ? cell.toDateTime() : QDateTime();
+                valid = dateTime.isValid();
+                if (valid && !timeZone) {
+                    // Arrow expects wall clock times as if they were UTC
+                    dateTime = QDateTime(dateTime.date(), dateTime.time(), Qt::UTC);
+                }
+                appendLE<qint64>(data, valid ? dateTime.toMSecsSinceEpoch() : 0);
+                break;
+            }
+            case QMetaType::QByteArray:
+                if (valid) {
+                    data.append(cell.toByteArray());
+                }
+                break;
+            default:
+                if (valid) {
+                    const std::string value = cell.toStdString();
+                    data.append(value.data(), int(value.size()));
+                }
+            }
+
+            if (variableSize) {
+                if (data.size() > std::numeric_limits<qint32>::max() - 1) {
+                    setError(QStringLiteral("Column %1 data is too large for a single batch").arg(names[column]));
+                    return false;
+                }
+                appendLE<qint32>(offsets, data.size());
+            }
+
+            if (valid) {
+                validity[int(row / 8)] = char(validity[int(row / 8)] | (1 << (row % 8)));
+            } else {
+                ++nullCount;
+            }
+        }
+    }
+
+    auto addBuffer = [&buffers, &body] (const QByteArray &buffer) {
+        buffers << body.size() << buffer.size();
+        body.append(buffer);
+        padBody(body);
+    };
+
+    nodes << pendingRows << nullCount;
+    // The validity bitmap can be omitted when there are no nulls
+    addBuffer(nullCount ? validity : QByteArray());
+    if (variableSize) {
+        addBuffer(offsets);
+    }
+    addBuffer(data);
+
+    return true;
+}
+
+bool AArrowWriterPrivate::writeBatch()
+{
+    QVector<qint64> nodes;
+    QVector<qint64> buffers;
+    QByteArray body;
+    for (int i = 0; i < types.size(); ++i) {
+        if (!encodeColumn(i, nodes, buffers, body)) {
+            return false;
+        }
+    }
+
+    const qint64 rows = pendingRows;
+    const QByteArray metadata = arrowMessage(ArrowHeaderRecordBatch, [=] (AFlatBuilder &b) {
+        return b.table({
+                           AFlatBuilder::scalar(0, 8, quint64(rows)),
+                           AFlatBuilder::offset(1, [=] (AFlatBuilder &b) { return b.structVector(nodes); }),
+                           AFlatBuilder::offset(2, [=] (AFlatBuilder &b) { return b.structVector(buffers); }),
+                       });
+    }, body.size());
+
+    pending.clear();
+    pendingRows = 0;
+
+    QByteArray message;
+    appendLE<quint32>(message, 0xFFFFFFFF);
+    appendLE<qint32>(message, metadata.size());
+    message.append(metadata);
+    return write(message) && write(body);
+}
+
+void AArrowWriterPrivate::setError(const QString &error)
+{
+    qWarning(ASQL_ARROW) << error;
+    errorString = error;
+}
+
+AArrowWriter::AArrowWriter(QIODevice *device, int batchRows) : d(new AArrowWriterPrivate)
+{
+    d->device = device;
+    d->batchRows = qMax(1, batchRows);
+}
+
+AArrowWriter::~AArrowWriter() = default;
+
+bool AArrowWriter::append(const AResult &result)
+{
+    if (!d->errorString.isEmpty()) {
+        return false;
+    }
+
+    if (d->finished) {
+        d->setError(QStringLiteral("Can not append rows to a finished Arrow stream"));
+        return false;
+    }
+
+    if (result.error()) {
+        d->setError(result.errorString());
+        return false;
+    }
+
+    if (!d->schemaWritten && !d->writeSchema(result)) {
+        return false;
+    }
+
+    if (result.fields() != d->types.size()) {
+        d->setError(QStringLiteral("Appended result has %1 columns, expected %2").arg(result.fields()).arg(d->types.size()));
+        return false;
+    }
+
+    if (result.size()) {
+        d->pending.append(result);
+        d->pendingRows += result.size();
+        if (d->pendingRows >= d->batchRows) {
+            return d->writeBatch();
+        }
+    }
+
+    return true;
+}
+
+bool AArrowWriter::flush()
+{
+    if (!d->errorString.isEmpty()) {
+        return false;
+    }
+    return d->pendingRows == 0 || d->writeBatch();
+}
+
+bool AArrowWriter::finish()
+{
+    if (d->finished) {
+        return d->errorString.isEmpty();
+    }
+
+    if (!d->schemaWritten) {
+        d->setError(QStringLiteral("No result was appended, the Arrow schema is unknown"));
+        return false;
+    }
+
+    if (!flush()) {
+        return false;
+    }
+
+    d->finished = true;
+
+    QByteArray eos;
+    appendLE<quint32>(eos, 0xFFFFFFFF);
+    appendLE<qint32>(eos, 0);
+    return d->write(eos);
+}
+
+QString AArrowWriter::errorString() const
+{
+    return d->errorString;
+}
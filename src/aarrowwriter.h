@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef AARROWWRITER_H
+#define AARROWWRITER_H
+
+#include <QString>
+
+#include <memory>
+
+#include <aresult.h>
+
+#include <asqlexports.h>
+
+class QIODevice;
+
+namespace ASql {
+
+class AArrowWriterPrivate;
+
+/*!
+ * \brief The AArrowWriter class writes results as an Apache Arrow IPC stream
+ *
+ * The schema is taken from the first appended result, column types come from
+ * \sa AResultPrivate::columnType(), for PostgreSQL this maps the column OIDs
+ * to the matching Arrow types (int2 to Int16, float4 to Float32, timestamp to
+ * a millisecond Timestamp...). Types without a native mapping are written as Utf8.
+ *
+ * Rows are accumulated until \p batchRows rows are available and then written
+ * as a single record batch, this allows streaming results received in single
+ * row mode without producing one batch per row.
+ *
+ * \code{.cpp}
+ * auto writer = std::make_shared<AArrowWriter>(device);
+ * db.exec(u"SELECT * FROM events", [writer] (AResult &result) {
+ *     writer->append(result);
+ *     if (result.lastResulSet()) {
+ *         writer->finish();
+ *     }
+ * });
+ * db.setLastQuerySingleRowMode();
+ * \endcode
+ */
+class ASQL_EXPORT AArrowWriter
+{
+public:
+    /*!
+     * \brief AArrowWriter constructs a new writer
+     * \param device must be open for writing and outlive the writer
+     * \param batchRows number of rows per record batch
+     */
+    explicit AArrowWriter(QIODevice *device, int batchRows = 65536);
+    ~AArrowWriter();
+
+    /*!
+     * \brief append appends all rows of \p result, the first appended result
+     * defines the schema which is written right away
+     * \param result
+     * \return false on error
+     */
+    bool append(const AResult &result);
+
+    /*!
+     * \brief flush writes the pending rows as a record batch
+     * \return false on error
+     */
+    bool flush();
+
+    /*!
+     * \brief finish flushes pending rows and writes the end of stream marker
+     * \return false on error
+     */
+    bool finish();
+
+    QString errorString() const;
+
+private:
+    std::unique_ptr<AArrowWriterPrivate> d;
+};
+
+}
+
+#endif // AARROWWRITER_H
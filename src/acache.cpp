@@ -7,9 +7,18 @@
 #include "adatabase.h"
 #include "apool.h"
 #include "aresult.h"
+#include "aresultvalues.h"
 
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <QPointer>
+#include <QTimer>
+#include <QtEndian>
 
 #include <QLoggingCategory>
 
@@ -29,11 +38,37 @@ struct ACacheValue {
     std::shared_ptr<QObject> cancellable;
     std::vector<ACacheReceiverCb> receivers;
     AResult result;
+    QByteArray json;
+    QByteArray cbor;
     qint64 hasResultTs = 0;
 };
 
+struct ACacheIncremental {
+    QString query;
+    QVariantList args;
+    QString keyColumn;
+    QString watermarkColumn;
+    std::shared_ptr<QObject> cancellable;
+    std::vector<ACacheReceiverCb> receivers;
+    QStringList fieldNames;
+    QVector<QVariantList> rows;
+    QHash<QString, int> rowByKey;
+    QString watermark;
+    AResult result;
+    qint64 refreshedTs = 0;
+    int keyIndex = -1;
+    int watermarkIndex = -1;
+    bool fetching = false;
+};
+
+struct ACacheShared {
+    QString query;
+    QVariantList args;
+};
+
 class ACachePrivate
 {
+    Q_DECLARE_PUBLIC(ACache)
 public:
     enum class DbSource {
         Unset,
@@ -43,10 +78,25 @@ public:
 
     bool searchOrQueue(QStringView query, qint64 maxAgeMs, const QVariantList &args, AResultFn cb, QObject *receiver);
     void requestData(const QString &query, qint64 maxAgeMs, const QVariantList &args, AResultFn cb, QObject *receiver);
-
+    QByteArray serialized(QStringView query, const QVariantList &args, const AResult &result, ACache::Format format);
+    bool database(ADatabase &database);
+    void refreshIncremental(const std::shared_ptr<ACacheIncremental> &entry);
+    void dispatch(const QString &query, const QVariantList &args, AResult &result, const QByteArray &cbor = {});
+    void requestShared(ADatabase &db, const QString &query, qint64 maxAgeMs, const QVariantList &args, const std::shared_ptr<QObject> &cancellable);
+    void waitShared(qint64 key, const QString &query, const QVariantList &args, const std::shared_ptr<QObject> &cancellable);
+    void fetchShared(qint64 key, const ACacheShared &shared);
+    void runLocal(const QString &query, const QVariantList &args);
+    void clearShared(const QVariant &key, qint64 maxAgeMs);
+
+    ACache *q_ptr;
     QString poolName;
     ADatabase db;
+    ADatabase sharedListener;
+    QHash<qint64, ACacheShared> sharedWaiting;
+    qint64 sharedWaitTimeoutMs = 5000;
+    bool shared = false;
     QMultiHash<QStringView, ACacheValue> cache;
+    QMultiHash<QString, std::shared_ptr<ACacheIncremental>> incremental;
     DbSource dbSource = DbSource::Unset;
 };
 
@@ -97,12 +147,7 @@ void ACachePrivate::requestData(const QString &query, qint64 maxAgeMs, const QVa
     qCDebug(ASQL_CACHE) << "requesting data" << query << int(dbSource);
 
     ADatabase _db;
-    if (dbSource == ACachePrivate::DbSource::Database) {
-        _db = db;
-    } else if (dbSource == ACachePrivate::DbSource::Pool) {
-        _db = APool::database(poolName);
-    } else {
-        qCCritical(ASQL_CACHE) << "Pool database was not set" << int(dbSource);
+    if (!database(_db)) {
         AResult result;
         cb(result);
         return;
@@ -119,25 +164,451 @@ void ACachePrivate::requestData(const QString &query, qint64 maxAgeMs, const QVa
                                   });
     cache.insert(query, _value);
 
+    if (shared) {
+        requestShared(_db, query, maxAgeMs, args, _value.cancellable);
+        return;
+    }
+
     _db.exec(query, args, [query, args, this] (AResult &result) {
-        auto it = cache.find(query);
-        while (it != cache.end() && it.key() == query) {
-            ACacheValue &value = it.value();
-            if (value.args == args) {
-                value.result = result;
-                value.hasResultTs = QDateTime::currentMSecsSinceEpoch();
-                qInfo(ASQL_CACHE) << "got request data, dispatching to" << value.receivers.size() << "receivers" << query;
-                for (const ACacheReceiverCb &receiverObj : value.receivers) {
-                    if (receiverObj.checkReceiver == nullptr || !receiverObj.receiver.isNull()) {
-                        qDebug(ASQL_CACHE) << "dispatching to receiver" << receiverObj.checkReceiver << query;
-                        receiverObj.cb(result);
-                    }
+        dispatch(query, args, result);
+    }, _value.cancellable.get());
+}
+
+void ACachePrivate::dispatch(const QString &query, const QVariantList &args, AResult &result, const QByteArray &cbor)
+{
+    auto it = cache.find(query);
+    while (it != cache.end() && it.key() == query) {
+        ACacheValue &value = it.value();
+        if (value.args == args) {
+            value.result = result;
+            value.json.clear();
+            value.cbor = cbor;
+            value.hasResultTs = QDateTime::currentMSecsSinceEpoch();
+            qInfo(ASQL_CACHE) << "got request data, dispatching to" << value.receivers.size() << "receivers" << query;
+            for (const ACacheReceiverCb &receiverObj : value.receivers) {
+                if (receiverObj.checkReceiver == nullptr || !receiverObj.receiver.isNull()) {
+                    qDebug(ASQL_CACHE) << "dispatching to receiver" << receiverObj.checkReceiver << query;
+                    receiverObj.cb(result);
                 }
-                value.receivers.clear();
             }
-            ++it;
+            value.receivers.clear();
         }
-    }, _value.cancellable.get());
+        ++it;
+    }
+}
+
+static const QString sharedChannel = QStringLiteral("asql_cache");
+
+// The class id of the two keys advisory lock, "ASQL", so it can't clash with locks taken on a single bigint
+static const qint32 sharedLockClass = 0x4153514C;
+
+/*
+ * The key must be the same on every process, qHash() is seeded
+ * per process so a digest of the query and the arguments is used
+ */
+static qint64 sharedKey(const QString &query, const QVariantList &args)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(query.toUtf8());
+    hash.addData(QCborValue(QCborArray::fromVariantList(args)).toCbor());
+    return qFromBigEndian<qint64>(hash.result().constData());
+}
+
+/*
+ * The stored data has the result CBOR, as returned by AResult::toCbor(), and the
+ * QMetaType of each column, so that every process gets values of the same types
+ */
+static QByteArray encodeShared(const AResult &result)
+{
+    QCborArray types;
+    for (int i = 0; i < result.fields(); ++i) {
+        types.append(qint64(result.columnType(i)));
+    }
+
+    QCborMap shared;
+    shared.insert(QLatin1String("types"), types);
+    shared.insert(QLatin1String("result"), result.toCbor());
+    return shared.toCborValue().toCbor();
+}
+
+static QVariant decodeSharedValue(const QCborValue &value, int type)
+{
+    if (value.isNull() || value.isUndefined()) {
+        return {};
+    }
+
+    switch (type) {
+    case QMetaType::QByteArray:
+        return value.toByteArray();
+    case QMetaType::QJsonValue:
+    case QMetaType::QJsonObject:
+    case QMetaType::QJsonArray:
+    case QMetaType::QJsonDocument:
+    {
+        // JSON columns are written as their text
+        const QJsonDocument doc = QJsonDocument::fromJson(value.toString().toUtf8());
+        if (type == QMetaType::QJsonDocument) {
+            return doc;
+        } else if (doc.isObject()) {
+            return type == QMetaType::QJsonValue ? QVariant(QJsonValue(doc.object())) : QVariant(doc.object());
+        } else if (doc.isArray()) {
+            return type == QMetaType::QJsonValue ? QVariant(QJsonValue(doc.array())) : QVariant(doc.array());
+        }
+        return value.toVariant();
+    }
+    default:
+    {
+        // NUMERIC and timestamps without time zone are written as text
+        QVariant ret = value.toVariant();
+        if (type != QMetaType::UnknownType && ret.userType() != type) {
+#if (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
+            ret.convert(QMetaType(type));
+#else
+            ret.convert(type);
+#endif
+        }
+        return ret;
+    }
+    }
+}
+
+static bool decodeShared(const QByteArray &stored, AResult &result, QByteArray &resultCbor)
+{
+    const QCborMap shared = QCborValue::fromCbor(stored).toMap();
+    const QCborArray types = shared.value(QLatin1String("types")).toArray();
+    resultCbor = shared.value(QLatin1String("result")).toByteArray();
+
+    const QCborMap map = QCborValue::fromCbor(resultCbor).toMap();
+    const QCborArray columns = map.value(QLatin1String("columns")).toArray();
+    const QCborArray rows = map.value(QLatin1String("rows")).toArray();
+    if (columns.isEmpty() || types.size() != columns.size()) {
+        return false;
+    }
+
+    QStringList fieldNames;
+    QVector<int> columnTypes;
+    fieldNames.reserve(int(columns.size()));
+    columnTypes.reserve(int(columns.size()));
+    for (qsizetype i = 0; i < columns.size(); ++i) {
+        fieldNames.append(columns.at(i).toString());
+        columnTypes.append(int(types.at(i).toInteger()));
+    }
+
+    auto values = std::make_shared<AResultValues>(fieldNames, QVector<QVariantList>(), columnTypes);
+    for (const QCborValue &row : rows) {
+        const QCborArray rowArray = row.toArray();
+        if (rowArray.size() != columns.size()) {
+            return false;
+        }
+
+        QVariantList rowValues;
+        rowValues.reserve(int(rowArray.size()));
+        for (qsizetype i = 0; i < rowArray.size(); ++i) {
+            rowValues.append(decodeSharedValue(rowArray.at(i), columnTypes[int(i)]));
+        }
+        values->appendRow(rowValues);
+    }
+    result = AResult(values);
+    return true;
+}
+
+void ACachePrivate::requestShared(ADatabase &db, const QString &query, qint64 maxAgeMs, const QVariantList &args, const std::shared_ptr<QObject> &cancellable)
+{
+    const qint64 key = sharedKey(query, args);
+    std::weak_ptr<QObject> alive = cancellable;
+
+    // The transaction level lock is released by the commit that makes the stored result visible
+    db.begin();
+    db.exec(u"SELECT s.data, CASE WHEN s.data IS NULL THEN pg_try_advisory_xact_lock($3::int4, $4::int4) ELSE false END AS locked "
+            "FROM (SELECT 1) asql_one "
+            "LEFT JOIN asql_cache_shared s ON s.key = $1::bigint "
+            "AND ($2::bigint IS NULL OR s.updated_at >= clock_timestamp() - $2::bigint * interval '1 millisecond')",
+            {key, maxAgeMs == -1 ? QVariant() : QVariant(maxAgeMs), sharedLockClass, qint32(key ^ (key >> 32))},
+            [this, db, key, query, args, alive] (AResult &lock) mutable {
+        const auto cancellable = alive.lock();
+        if (!cancellable) {
+            // the entry was cleared
+            db.rollback();
+            return;
+        }
+
+        if (lock.error() || !lock.size()) {
+            db.rollback();
+            qCWarning(ASQL_CACHE) << "Shared refresh failed, running query locally" << query << lock.errorString();
+            db.exec(query, args, [this, query, args, alive] (AResult &result) {
+                if (!alive.expired()) {
+                    dispatch(query, args, result);
+                }
+            }, cancellable.get());
+            return;
+        }
+
+        const QByteArray stored = lock.begin()[0].toByteArray();
+        if (!stored.isEmpty()) {
+            db.commit();
+            AResult result;
+            QByteArray cbor;
+            if (decodeShared(stored, result, cbor)) {
+                qCDebug(ASQL_CACHE) << "shared data ready" << query;
+                dispatch(query, args, result, cbor);
+            } else {
+                qCWarning(ASQL_CACHE) << "Failed to decode shared data, running query locally" << query;
+                runLocal(query, args);
+            }
+            return;
+        }
+
+        if (!lock.begin()[1].toBool()) {
+            // another process is refreshing it
+            db.rollback();
+            waitShared(key, query, args, cancellable);
+            return;
+        }
+
+        qCDebug(ASQL_CACHE) << "refreshing shared data" << query << key;
+        // No receiver, the transaction must be finished even if the entry is cleared meanwhile
+        db.exec(query, args, [this, db, key, query, args, alive] (AResult &result) mutable {
+            if (result.error()) {
+                db.rollback();
+                if (!alive.expired()) {
+                    dispatch(query, args, result);
+                }
+                return;
+            }
+
+            const QByteArray stored = encodeShared(result);
+            db.exec(u"INSERT INTO asql_cache_shared (key, data, updated_at) VALUES ($1, $2, clock_timestamp()) "
+                    "ON CONFLICT (key) DO UPDATE SET data = EXCLUDED.data, updated_at = EXCLUDED.updated_at",
+                    {key, stored}, {});
+            db.exec(u"SELECT pg_notify($1, $2)", {sharedChannel, QString::number(key)}, {});
+            db.commit();
+
+            if (!alive.expired()) {
+                // The same decoded values the other processes get
+                AResult decoded;
+                QByteArray cbor;
+                if (decodeShared(stored, decoded, cbor)) {
+                    dispatch(query, args, decoded, cbor);
+                } else {
+                    dispatch(query, args, result);
+                }
+            }
+        });
+    });
+}
+
+void ACachePrivate::waitShared(qint64 key, const QString &query, const QVariantList &args, const std::shared_ptr<QObject> &cancellable)
+{
+    qCDebug(ASQL_CACHE) << "waiting for shared data" << query << key;
+    sharedWaiting.insert(key, ACacheShared{query, args});
+
+    QTimer::singleShot(int(sharedWaitTimeoutMs), cancellable.get(), [this, key] {
+        auto it = sharedWaiting.find(key);
+        if (it != sharedWaiting.end()) {
+            const ACacheShared waiting = it.value();
+            sharedWaiting.erase(it);
+            // the notification might have been sent before we started waiting
+            qCInfo(ASQL_CACHE) << "Timeout waiting for shared data" << waiting.query;
+            fetchShared(key, waiting);
+        }
+    });
+}
+
+void ACachePrivate::fetchShared(qint64 key, const ACacheShared &shared)
+{
+    Q_Q(ACache);
+    ADatabase _db;
+    if (!database(_db)) {
+        AResult result;
+        dispatch(shared.query, shared.args, result);
+        return;
+    }
+
+    _db.exec(u"SELECT data FROM asql_cache_shared WHERE key = $1", {key}, [this, shared] (AResult &stored) {
+        AResult result;
+        if (!stored.error() && stored.size()) {
+            QByteArray cbor;
+            if (decodeShared(stored.begin()[0].toByteArray(), result, cbor)) {
+                qCDebug(ASQL_CACHE) << "shared data ready" << shared.query;
+                dispatch(shared.query, shared.args, result, cbor);
+                return;
+            }
+        }
+
+        qCWarning(ASQL_CACHE) << "Shared data not available, running query locally" << shared.query << stored.errorString();
+        runLocal(shared.query, shared.args);
+    }, q);
+}
+
+void ACachePrivate::runLocal(const QString &query, const QVariantList &args)
+{
+    Q_Q(ACache);
+    ADatabase _db;
+    if (!database(_db)) {
+        AResult result;
+        dispatch(query, args, result);
+        return;
+    }
+
+    _db.exec(query, args, [this, query, args] (AResult &result) {
+        dispatch(query, args, result);
+    }, q);
+}
+
+/*
+ * Deletes the stored copies so no process reads them back, a null \p key deletes
+ * the copies of every entry and \p maxAgeMs only the ones older than it, -1 at any age
+ */
+void ACachePrivate::clearShared(const QVariant &key, qint64 maxAgeMs)
+{
+    ADatabase _db;
+    if (!shared || !database(_db)) {
+        return;
+    }
+
+    _db.exec(u"DELETE FROM asql_cache_shared WHERE ($1::bigint IS NULL OR key = $1::bigint) "
+             "AND ($2::bigint IS NULL OR updated_at < clock_timestamp() - $2::bigint * interval '1 millisecond')",
+             {key, maxAgeMs == -1 ? QVariant() : QVariant(maxAgeMs)}, [] (AResult &result) {
+        if (result.error()) {
+            qCWarning(ASQL_CACHE) << "Failed to clear shared data" << result.errorString();
+        }
+    });
+}
+
+bool ACachePrivate::database(ADatabase &database)
+{
+    if (dbSource == ACachePrivate::DbSource::Database) {
+        database = db;
+    } else if (dbSource == ACachePrivate::DbSource::Pool) {
+        database = APool::database(poolName);
+    } else {
+        qCCritical(ASQL_CACHE) << "Pool database was not set" << int(dbSource);
+        return false;
+    }
+    return true;
+}
+
+static QString quoteIdentifier(const QString &identifier)
+{
+    QString ret = identifier;
+    ret.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + ret + QLatin1Char('"');
+}
+
+static void dispatchIncremental(const std::shared_ptr<ACacheIncremental> &entry, AResult &result)
+{
+    const auto receivers = std::move(entry->receivers);
+    entry->receivers.clear();
+    for (const ACacheReceiverCb &receiverObj : receivers) {
+        if (receiverObj.cb && (receiverObj.checkReceiver == nullptr || !receiverObj.receiver.isNull())) {
+            receiverObj.cb(result);
+        }
+    }
+}
+
+static void mergeIncremental(const std::shared_ptr<ACacheIncremental> &entry, AResult &result)
+{
+    entry->fetching = false;
+    if (result.error()) {
+        qCWarning(ASQL_CACHE) << "Failed to refresh incremental cache" << entry->query << result.errorString();
+        dispatchIncremental(entry, result);
+        return;
+    }
+
+    if (entry->fieldNames.isEmpty()) {
+        entry->fieldNames = result.columnNames();
+        entry->keyIndex = entry->fieldNames.indexOf(entry->keyColumn);
+        entry->watermarkIndex = entry->fieldNames.indexOf(entry->watermarkColumn);
+        if (entry->keyIndex == -1 || entry->watermarkIndex == -1) {
+            qCCritical(ASQL_CACHE) << "Key or watermark column not found" << entry->keyColumn << entry->watermarkColumn << entry->fieldNames;
+        }
+    }
+
+    for (auto row : result) {
+        const QVariantList values = row.toList();
+        const QString key = values.value(entry->keyIndex).toString();
+        auto it = entry->rowByKey.constFind(key);
+        if (it != entry->rowByKey.constEnd()) {
+            entry->rows[it.value()] = values;
+        } else {
+            entry->rowByKey.insert(key, entry->rows.size());
+            entry->rows.append(values);
+        }
+
+        // rows are ordered by the watermark with NULLs first, so the last non-null one has
+        // the highest value, kept as the server sent it so no precision or time zone is lost
+        if (entry->watermarkIndex != -1 && !row[entry->watermarkIndex].isNull()) {
+            entry->watermark = row[entry->watermarkIndex].toString();
+        }
+    }
+
+    qCDebug(ASQL_CACHE) << "incremental refresh merged" << result.size() << "rows" << entry->query;
+    entry->refreshedTs = QDateTime::currentMSecsSinceEpoch();
+    if (result.size() || entry->result.error()) {
+        // only a new object when something changed, so unchanged refreshes keep the same result
+        entry->result = AResult(std::make_shared<AResultValues>(entry->fieldNames, entry->rows));
+    }
+    dispatchIncremental(entry, entry->result);
+}
+
+void ACachePrivate::refreshIncremental(const std::shared_ptr<ACacheIncremental> &entry)
+{
+    ADatabase _db;
+    if (!database(_db)) {
+        AResult result;
+        dispatchIncremental(entry, result);
+        return;
+    }
+
+    const QString watermark = quoteIdentifier(entry->watermarkColumn);
+    QString query = QLatin1String("SELECT * FROM (") + entry->query + QLatin1String(") asql_inc");
+    QVariantList params = entry->args;
+    if (entry->refreshedTs && !entry->watermark.isNull()) {
+        // An untyped literal is parsed by the server as the type of the column,
+        // while a text parameter can't be compared to a timestamp or a number
+        QString literal = entry->watermark;
+        literal.replace(QLatin1Char('\''), QLatin1String("''"));
+        query += QLatin1String(" WHERE ") + watermark + QLatin1String(" > '") + literal + QLatin1Char('\'');
+    }
+    query += QLatin1String(" ORDER BY ") + watermark + QLatin1String(" NULLS FIRST");
+
+    qCDebug(ASQL_CACHE) << "incremental refresh" << entry->query << entry->watermark;
+    entry->fetching = true;
+    _db.exec(query, params, [entry] (AResult &result) {
+        mergeIncremental(entry, result);
+    }, entry->cancellable.get());
+}
+
+static QByteArray serialize(const AResult &result, ACache::Format format)
+{
+    if (format == ACache::Format::Cbor) {
+        return result.toCbor();
+    }
+    return QJsonDocument(result.toJsonArray()).toJson(QJsonDocument::Compact);
+}
+
+QByteArray ACachePrivate::serialized(QStringView query, const QVariantList &args, const AResult &result, ACache::Format format)
+{
+    if (result.error()) {
+        return {};
+    }
+
+    auto it = cache.find(query);
+    while (it != cache.end() && it.key() == query) {
+        ACacheValue &value = it.value();
+        if (value.args == args && value.result == result) {
+            QByteArray &payload = format == ACache::Format::Cbor ? value.cbor : value.json;
+            if (payload.isNull()) {
+                qDebug(ASQL_CACHE) << "serializing cached data" << query;
+                payload = serialize(result, format);
+            }
+            return payload;
+        }
+        ++it;
+    }
+
+    // the entry was cleared or replaced
+    return serialize(result, format);
 }
 
 }
@@ -147,7 +618,7 @@ using namespace ASql;
 ACache::ACache(QObject *parent) : QObject(parent)
   , d_ptr(new ACachePrivate)
 {
-
+    d_ptr->q_ptr = this;
 }
 
 ACache::~ACache() = default;
@@ -173,9 +644,69 @@ void ACache::setDatabase(const ADatabase &db)
     d->dbSource = ACachePrivate::DbSource::Database;
 }
 
+void ACache::setSharedRefresh(const ADatabase &listener, qint64 waitTimeoutMs)
+{
+    Q_D(ACache);
+    d->sharedListener = listener;
+    d->sharedWaitTimeoutMs = waitTimeoutMs;
+    d->shared = d->sharedListener.isValid();
+    if (!d->shared) {
+        return;
+    }
+
+    d->sharedListener.onStateChanged([this] (ADatabase::State state, const QString &status) {
+        Q_D(ACache);
+        if (state != ADatabase::State::Connected) {
+            qCDebug(ASQL_CACHE) << "Shared refresh listener state" << int(state) << status;
+            return;
+        }
+
+        d->sharedListener.subscribeToNotification(sharedChannel, [this] (const ADatabaseNotification &notification) {
+            Q_D(ACache);
+            bool ok;
+            const qint64 key = notification.payload.toString().toLongLong(&ok);
+            if (!ok) {
+                return;
+            }
+
+            auto it = d->sharedWaiting.find(key);
+            if (it != d->sharedWaiting.end()) {
+                const ACacheShared waiting = it.value();
+                d->sharedWaiting.erase(it);
+                d->fetchShared(key, waiting);
+            }
+        }, this);
+    });
+
+    if (!d->sharedListener.isOpen()) {
+        d->sharedListener.open();
+    }
+}
+
+QString ACache::sharedRefreshSql()
+{
+    return QStringLiteral("CREATE UNLOGGED TABLE IF NOT EXISTS asql_cache_shared (\n"
+                          "    key bigint PRIMARY KEY,\n"
+                          "    data bytea NOT NULL,\n"
+                          "    updated_at timestamptz NOT NULL\n"
+                          ");\n");
+}
+
 bool ACache::clear(QStringView query, const QVariantList &params)
 {
     Q_D(ACache);
+    const QString queryString = query.toString();
+    auto incrementalIt = d->incremental.find(queryString);
+    while (incrementalIt != d->incremental.end() && incrementalIt.key() == queryString) {
+        if (incrementalIt.value()->args == params && !incrementalIt.value()->fetching) {
+            incrementalIt = d->incremental.erase(incrementalIt);
+        } else {
+            ++incrementalIt;
+        }
+    }
+
+    d->clearShared(sharedKey(queryString, params), -1);
+
     auto it = d->cache.constFind(query);
     while (it != d->cache.constEnd() && it.key() == query) {
         if (it.value().args == params) {
@@ -193,6 +724,7 @@ bool ACache::expire(qint64 maxAgeMs, QStringView query, const QVariantList &para
     Q_D(ACache);
     int ret = false;
     const qint64 cutAge = QDateTime::currentMSecsSinceEpoch() - maxAgeMs;
+    d->clearShared(sharedKey(query.toString(), params), maxAgeMs);
     auto it = d->cache.constFind(query);
     while (it != d->cache.constEnd() && it.key() == query) {
         const ACacheValue &value = *it;
@@ -214,6 +746,7 @@ int ACache::expireAll(qint64 maxAgeMs)
     Q_D(ACache);
     int ret = 0;
     const qint64 cutAge = QDateTime::currentMSecsSinceEpoch() - maxAgeMs;
+    d->clearShared(QVariant(), maxAgeMs);
     auto it = d->cache.begin();
     while (it != d->cache.end()) {
         const ACacheValue &value = *it;
@@ -273,4 +806,61 @@ void ACache::execExpiring(const QString &query, qint64 maxAgeMs, const QVariantL
     }
 }
 
+void ACache::execSerialized(QStringView query, Format format, qint64 maxAgeMs, const QVariantList &args, ACacheSerializedFn cb, QObject *receiver)
+{
+    const QString queryString = query.toString();
+    execExpiring(queryString, maxAgeMs, args, [this, queryString, args, format, cb] (AResult &result) {
+        Q_D(ACache);
+        const QByteArray payload = d->serialized(queryString, args, result, format);
+        if (cb) {
+            cb(result, payload);
+        }
+    }, receiver);
+}
+
+void ACache::execIncremental(QStringView query, const QString &keyColumn, const QString &watermarkColumn, qint64 refreshAgeMs,
+                             const QVariantList &args, AResultFn cb, QObject *receiver)
+{
+    Q_D(ACache);
+    std::shared_ptr<ACacheIncremental> entry;
+    const QString queryString = query.toString();
+    auto it = d->incremental.find(queryString);
+    while (it != d->incremental.end() && it.key() == queryString) {
+        const auto &value = it.value();
+        if (value->args == args && value->keyColumn == keyColumn && value->watermarkColumn == watermarkColumn) {
+            entry = value;
+            break;
+        }
+        ++it;
+    }
+
+    if (!entry) {
+        entry = std::make_shared<ACacheIncremental>();
+        entry->query = queryString;
+        entry->args = args;
+        entry->keyColumn = keyColumn;
+        entry->watermarkColumn = watermarkColumn;
+        entry->cancellable = std::make_shared<QObject>();
+        d->incremental.insert(queryString, entry);
+    }
+
+    if (entry->refreshedTs && !entry->fetching &&
+            (refreshAgeMs == -1 || entry->refreshedTs >= QDateTime::currentMSecsSinceEpoch() - refreshAgeMs)) {
+        qDebug(ASQL_CACHE) << "cached data ready" << query;
+        if (cb) {
+            cb(entry->result);
+        }
+        return;
+    }
+
+    entry->receivers.emplace_back(ACacheReceiverCb {
+                                      cb,
+                                      receiver,
+                                      receiver
+                                  });
+    if (!entry->fetching) {
+        d->refreshIncremental(entry);
+    }
+}
+
 #include "moc_acache.cpp"
@@ -14,12 +14,20 @@
 
 namespace ASql {
 
+using ACacheSerializedFn = std::function<void(AResult &result, const QByteArray &payload)>;
+
 class ACachePrivate;
 class ASQL_EXPORT ACache : public QObject
 {
     Q_OBJECT
     Q_DECLARE_PRIVATE(ACache)
 public:
+    enum class Format {
+        Json,
+        Cbor,
+    };
+    Q_ENUM(Format)
+
     explicit ACache(QObject *parent = nullptr);
     virtual ~ACache();
 
@@ -27,6 +35,34 @@ public:
     void setDatabasePool(QStringView poolName);
     void setDatabase(const ADatabase &db);
 
+    /*!
+     * \brief setSharedRefresh makes processes sharing a database refresh each entry only once
+     *
+     * Before running a query the cache looks for a fresh copy stored by another process in
+     * the asql_cache_shared table, \sa sharedRefreshSql(). If there is none it tries to take
+     * a transaction level advisory lock on the hash of the query and its arguments, the
+     * process that gets it runs the query, stores the result as CBOR along with the type of
+     * each column, so every process gets values of the same types, and notifies the others,
+     * which wait for that notification and then read the stored result instead of running the
+     * query again. If the notification doesn't arrive in \p waitTimeoutMs the query is run locally.
+     *
+     * \param listener a dedicated connection used to LISTEN for refreshes, its state changed
+     * callback is taken, an invalid database disables shared refreshes
+     * \param waitTimeoutMs
+     */
+    void setSharedRefresh(const ADatabase &listener, qint64 waitTimeoutMs = 5000);
+
+    /*!
+     * \brief sharedRefreshSql returns the SQL that creates the table used by \sa setSharedRefresh()
+     *
+     * The table is UNLOGGED as it's only a cache, it's meant to be added to the application migrations.
+     *
+     * \sa clear() and \sa expire() also delete the stored copy of the entry, so exec() without an age
+     * limit doesn't read it back. Rows of entries no longer requested are only deleted by \sa expireAll(),
+     * which deletes the ones older than its age on every process, call it periodically to prune the table.
+     */
+    static QString sharedRefreshSql();
+
     /*!
      * \brief clear que requested query from the cache, do not call this from the exec callback
      * \param query
@@ -47,6 +83,51 @@ public:
     void execExpiring(const QString &query, qint64 maxAgeMs, AResultFn cb, QObject *receiver = nullptr);
     void execExpiring(const QString &query, qint64 maxAgeMs, const QVariantList &args, AResultFn cb, QObject *receiver = nullptr);
 
+    /*!
+     * \brief execSerialized same as \sa execExpiring() but \p cb also receives the result serialized in \p format
+     *
+     * The serialized payload is stored with the cache entry the first time it's requested,
+     * so further hits only copy the buffer instead of converting the result again.
+     * Json is an array of row objects like \sa AResult::toJsonArray(), Cbor is \sa AResult::toCbor().
+     * The payload is empty if the query failed.
+     *
+     * \param query
+     * \param format
+     * \param maxAgeMs -1 never expires
+     * \param args
+     * \param cb
+     * \param receiver
+     */
+    void execSerialized(QStringView query, Format format, qint64 maxAgeMs, const QVariantList &args, ACacheSerializedFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief execIncremental caches \p query and refreshes it by only fetching the rows that changed
+     *
+     * The first call fetches all rows, once the cached data is older than \p refreshAgeMs
+     * only rows with \p watermarkColumn greater than the last seen value are fetched, and
+     * merged into the cached rows by \p keyColumn. The watermark is usually an updated_at
+     * timestamp or a sequence that increases on every insert or update.
+     *
+     * Rows are ordered by \p watermarkColumn, updated rows keep their position and new ones are
+     * appended. Deleted rows are not detected, so this is meant for append-mostly tables,
+     * \sa clear() forces a full fetch on the next call.
+     *
+     * Rows committed after a refresh with a watermark lower than the last seen value, like a
+     * long transaction setting updated_at = now() or taking a sequence value before a shorter
+     * one commits, are missed until the next full fetch. Rows with a NULL watermark are only
+     * fetched by a full fetch.
+     *
+     * \param query
+     * \param keyColumn
+     * \param watermarkColumn
+     * \param refreshAgeMs -1 never refreshes
+     * \param args
+     * \param cb
+     * \param receiver
+     */
+    void execIncremental(QStringView query, const QString &keyColumn, const QString &watermarkColumn, qint64 refreshAgeMs,
+                         const QVariantList &args, AResultFn cb, QObject *receiver = nullptr);
+
 private:
     ACachePrivate *d_ptr;
 };
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aconnectionlimiter.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QPointer>
+#include <QQueue>
+#include <QTimer>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(ASQL_LIMITER, "asql.connection_limiter", QtInfoMsg)
+
+namespace ASql {
+
+struct AConnectionLimiterWaiter {
+    std::shared_ptr<QObject> guard;
+    QPointer<QObject> receiver;
+    std::function<void()> cb;
+};
+
+class AConnectionLimiterPrivate : public std::enable_shared_from_this<AConnectionLimiterPrivate>
+{
+public:
+    qint64 reserveSlot();
+    void dispatch(const AConnectionLimiterWaiter &waiter, qint64 delayMs);
+    void release();
+
+    QMutex mutex;
+    QQueue<AConnectionLimiterWaiter> waiters;
+    QElapsedTimer clock;
+    double intervalMs = 0;
+    double theoreticalArrival = 0;
+    int burst = 1;
+    int maxConcurrent = 0;
+    int running = 0;
+};
+
+/*!
+ * Takes a slot, returning in how many milliseconds the attempt
+ * might start to respect the rate, must be called with the mutex locked.
+ */
+qint64 AConnectionLimiterPrivate::reserveSlot()
+{
+    ++running;
+    if (intervalMs <= 0) {
+        return 0;
+    }
+
+    const double now = clock.elapsed();
+    theoreticalArrival = qMax(theoreticalArrival, now) + intervalMs;
+    return qMax(qint64(0), qint64(theoreticalArrival - burst * intervalMs - now));
+}
+
+void AConnectionLimiterPrivate::dispatch(const AConnectionLimiterWaiter &waiter, qint64 delayMs)
+{
+    auto self = shared_from_this();
+    // The guard lives in the receiver's thread
+    QMetaObject::invokeMethod(waiter.guard.get(), [self, waiter, delayMs] {
+        auto start = [self, waiter] {
+            if (waiter.receiver.isNull()) {
+                self->release();
+            } else {
+                waiter.cb();
+            }
+        };
+
+        if (delayMs > 0) {
+            qDebug(ASQL_LIMITER) << "Delaying connection attempt" << delayMs;
+            QTimer::singleShot(int(delayMs), waiter.guard.get(), start);
+        } else {
+            start();
+        }
+    }, Qt::QueuedConnection);
+}
+
+void AConnectionLimiterPrivate::release()
+{
+    QMutexLocker locker(&mutex);
+    --running;
+    while (!waiters.isEmpty() && (maxConcurrent <= 0 || running < maxConcurrent)) {
+        AConnectionLimiterWaiter waiter = waiters.dequeue();
+        const qint64 delayMs = reserveSlot();
+        dispatch(waiter, delayMs);
+    }
+}
+
+}
+
+using namespace ASql;
+
+AConnectionLimiter::AConnectionLimiter() : d(std::make_shared<AConnectionLimiterPrivate>())
+{
+    d->clock.start();
+}
+
+AConnectionLimiter::~AConnectionLimiter() = default;
+
+void AConnectionLimiter::setMaxConcurrent(int max)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maxConcurrent = max;
+}
+
+int AConnectionLimiter::maxConcurrent() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxConcurrent;
+}
+
+void AConnectionLimiter::setRate(double connectionsPerSecond, int burst)
+{
+    QMutexLocker locker(&d->mutex);
+    d->intervalMs = connectionsPerSecond > 0 ? 1000.0 / connectionsPerSecond : 0;
+    d->burst = qMax(1, burst);
+}
+
+void AConnectionLimiter::acquire(QObject *receiver, std::function<void()> cb)
+{
+    AConnectionLimiterWaiter waiter;
+    waiter.guard = std::shared_ptr<QObject>(new QObject, [] (QObject *obj) { obj->deleteLater(); });
+    waiter.receiver = receiver;
+    waiter.cb = cb;
+
+    QMutexLocker locker(&d->mutex);
+    if (d->waiters.isEmpty() && (d->maxConcurrent <= 0 || d->running < d->maxConcurrent)) {
+        const qint64 delayMs = d->reserveSlot();
+        if (delayMs == 0) {
+            locker.unlock();
+            cb();
+        } else {
+            d->dispatch(waiter, delayMs);
+        }
+    } else {
+        qDebug(ASQL_LIMITER) << "Queuing connection attempt" << d->running << d->waiters.size();
+        d->waiters.enqueue(waiter);
+    }
+}
+
+void AConnectionLimiter::release()
+{
+    d->release();
+}
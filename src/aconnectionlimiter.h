@@ -0,0 +1,72 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ACONNECTIONLIMITER_H
+#define ACONNECTIONLIMITER_H
+
+#include <QObject>
+
+#include <functional>
+#include <memory>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+class AConnectionLimiterPrivate;
+
+/*!
+ * \brief The AConnectionLimiter class smooths out connection storms
+ *
+ * After a failover every pool on every thread tries to reconnect at once, authentication
+ * and TLS handshakes then burn CPU on both ends and slow down the recovery itself.
+ *
+ * A limiter is shared by all drivers created by a factory, on all threads, it caps the number
+ * of connection attempts in progress and the rate in which new attempts are started, requests
+ * above the limits are queued and started in order.
+ */
+class ASQL_EXPORT AConnectionLimiter
+{
+public:
+    AConnectionLimiter();
+    ~AConnectionLimiter();
+
+    /*!
+     * \brief setMaxConcurrent maximum number of connection attempts in progress, 0 means unlimited
+     * \param max
+     */
+    void setMaxConcurrent(int max);
+    int maxConcurrent() const;
+
+    /*!
+     * \brief setRate maximum number of connection attempts started per second, 0 means unlimited
+     * \param connectionsPerSecond
+     * \param burst number of attempts that can be started at once before the rate applies
+     */
+    void setRate(double connectionsPerSecond, int burst = 1);
+
+    /*!
+     * \brief acquire calls \p cb on the \p receiver thread once a connection attempt can start,
+     * \sa release() must be called once the attempt is done.
+     *
+     * If \p receiver is deleted before that the callback is not called and the slot is released.
+     *
+     * \param receiver
+     * \param cb
+     */
+    void acquire(QObject *receiver, std::function<void()> cb);
+
+    /*!
+     * \brief release informs that a connection attempt has finished, either by success or failure
+     */
+    void release();
+
+private:
+    std::shared_ptr<AConnectionLimiterPrivate> d;
+};
+
+}
+
+#endif // ACONNECTIONLIMITER_H
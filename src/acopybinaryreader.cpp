@@ -0,0 +1,452 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "acopybinaryreader.h"
+
+#include "aresultvalues.h"
+
+#include <QDateTime>
+#include <QUuid>
+#include <QtEndian>
+#include <QLoggingCategory>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+Q_LOGGING_CATEGORY(ASQL_COPY, "asql.pg.copy", QtInfoMsg)
+
+using namespace ASql;
+
+// "PGCOPY\n\377\r\n\0"
+static const char copySignature[] = "PGCOPY\n\377\r\n";
+static const int copySignatureSize = 11;
+// signature, flags and header extension length
+static const int copyHeaderSize = copySignatureSize + 4 + 4;
+
+// PostgreSQL epoch is 2000-01-01
+static const qint64 pgEpochMSecs = 946684800000LL;
+static const qint64 usecsPerDay = 86400000000LL;
+
+static inline qint64 floorDiv(qint64 a, qint64 b)
+{
+    const qint64 ret = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? ret - 1 : ret;
+}
+
+static bool decodeNumeric(const char *data, int size, double &value)
+{
+    if (size < 8) {
+        return false;
+    }
+
+    const qint16 ndigits = qFromBigEndian<qint16>(data);
+    const qint16 weight = qFromBigEndian<qint16>(data + 2);
+    const quint16 sign = qFromBigEndian<quint16>(data + 4);
+    if (ndigits < 0 || size != 8 + 2 * ndigits) {
+        return false;
+    }
+
+    switch (sign) {
+    case 0xC000:
+        value = qQNaN();
+        return true;
+    case 0xD000:
+        value = qInf();
+        return true;
+    case 0xF000:
+        value = -qInf();
+        return true;
+    default:
+        break;
+    }
+
+    // digits are in base 10000, the first one multiplied by 10000^weight
+    value = 0;
+    for (int i = 0; i < ndigits; ++i) {
+        const qint16 digit = qFromBigEndian<qint16>(data + 8 + 2 * i);
+        value += digit * std::pow(10000.0, weight - i);
+    }
+    if (sign == 0x4000) {
+        value = -value;
+    }
+    return true;
+}
+
+static int metaTypeFromOid(quint32 type)
+{
+    switch (type) {
+    case ACopyBinaryReader::Bool:
+        return QMetaType::Bool;
+    case ACopyBinaryReader::Int2:
+    case ACopyBinaryReader::Int4:
+        return QMetaType::Int;
+    case ACopyBinaryReader::Int8:
+    case ACopyBinaryReader::Oid:
+        return QMetaType::LongLong;
+    case ACopyBinaryReader::Float4:
+    case ACopyBinaryReader::Float8:
+    case ACopyBinaryReader::Numeric:
+        return QMetaType::Double;
+    case ACopyBinaryReader::Date:
+        return QMetaType::QDate;
+    case ACopyBinaryReader::Time:
+    case ACopyBinaryReader::TimeTz:
+        return QMetaType::QTime;
+    case ACopyBinaryReader::Timestamp:
+    case ACopyBinaryReader::TimestampTz:
+        return QMetaType::QDateTime;
+    case ACopyBinaryReader::Name:
+    case ACopyBinaryReader::Text:
+    case ACopyBinaryReader::Json:
+    case ACopyBinaryReader::Bpchar:
+    case ACopyBinaryReader::Varchar:
+    case ACopyBinaryReader::Uuid:
+    case ACopyBinaryReader::Jsonb:
+        return QMetaType::QString;
+    default:
+        return QMetaType::QByteArray;
+    }
+}
+
+ACopyBinaryReader::ACopyBinaryReader(const QStringList &columnNames, const QVector<quint32> &types)
+    : m_columnNames(columnNames)
+    , m_types(types)
+{
+    Q_ASSERT_X(columnNames.size() == types.size(), "ACopyBinaryReader", "column names and types size differ");
+    m_metaTypes.reserve(types.size());
+    for (quint32 type : types) {
+        m_metaTypes.append(metaTypeFromOid(type));
+    }
+}
+
+bool ACopyBinaryReader::feed(const QByteArray &data)
+{
+    if (m_error) {
+        return false;
+    }
+
+    if (m_buffer.isEmpty()) {
+        // Usually each chunk has complete rows, avoid copying it
+        const int consumed = parse(data.constData(), data.size());
+        if (consumed < 0) {
+            return false;
+        }
+        if (consumed < data.size()) {
+            m_buffer = QByteArray(data.constData() + consumed, data.size() - consumed);
+        }
+    } else {
+        m_buffer.append(data);
+        const int consumed = parse(m_buffer.constData(), m_buffer.size());
+        if (consumed < 0) {
+            return false;
+        }
+        m_buffer.remove(0, consumed);
+    }
+    return true;
+}
+
+bool ACopyBinaryReader::atEnd() const
+{
+    return m_atEnd;
+}
+
+bool ACopyBinaryReader::error() const
+{
+    return m_error;
+}
+
+QString ACopyBinaryReader::errorString() const
+{
+    return m_errorString;
+}
+
+int ACopyBinaryReader::rowsAvailable() const
+{
+    return m_rows.size();
+}
+
+AResult ACopyBinaryReader::takeRows(bool lastResultSet)
+{
+    auto result = std::make_shared<AResultValues>(m_columnNames, m_rows, m_metaTypes);
+    result->setLastResultSet(lastResultSet);
+    m_rows.clear();
+    return AResult(result);
+}
+
+QVector<QVariantList> ACopyBinaryReader::takeColumns()
+{
+    QVector<QVariantList> columns(m_types.size());
+    for (QVariantList &column : columns) {
+        column.reserve(m_rows.size());
+    }
+
+    for (const QVariantList &row : qAsConst(m_rows)) {
+        for (int i = 0; i < row.size(); ++i) {
+            columns[i].append(row[i]);
+        }
+    }
+    m_rows.clear();
+    return columns;
+}
+
+void ACopyBinaryReader::copy(ADatabase db, const QString &query, const QStringList &columnNames, const QVector<quint32> &types,
+                             AResultFn cb, QObject *receiver, int batchRows)
+{
+    auto reader = std::make_shared<ACopyBinaryReader>(columnNames, types);
+    const QString copyQuery = QLatin1String("COPY (") + query + QLatin1String(") TO STDOUT (FORMAT binary)");
+
+    db.copyTo(copyQuery, [reader, cb, batchRows] (const QByteArray &data) {
+        // Decoding errors are reported once the COPY finishes
+        if (reader->feed(data) && cb && reader->rowsAvailable() >= batchRows) {
+            AResult rows = reader->takeRows();
+            cb(rows);
+        }
+    }, [reader, cb, columnNames] (AResult &result) {
+        if (!cb) {
+            return;
+        }
+
+        if (result.error()) {
+            cb(result);
+            return;
+        }
+
+        if (!reader->error() && !reader->atEnd()) {
+            reader->setError(QStringLiteral("Binary COPY data ended unexpectedly"));
+        }
+
+        if (reader->error()) {
+            auto failed = std::make_shared<AResultValues>(columnNames);
+            failed->setError(reader->errorString());
+            AResult failedResult(failed);
+            cb(failedResult);
+            return;
+        }
+
+        AResult rows = reader->takeRows(true);
+        cb(rows);
+    }, receiver);
+}
+
+/*!
+ * Decodes all complete rows, returning the number of bytes consumed or -1 on error
+ */
+int ACopyBinaryReader::parse(const char *data, int size)
+{
+    int pos = 0;
+    if (!m_headerRead) {
+        if (size < copyHeaderSize) {
+            return 0;
+        }
+
+        if (memcmp(data, copySignature, copySignatureSize) != 0) {
+            setError(QStringLiteral("Invalid binary COPY signature"));
+            return -1;
+        }
+
+        const qint64 extension = qFromBigEndian<quint32>(data + copySignatureSize + 4);
+        if (size < copyHeaderSize + extension) {
+            return 0;
+        }
+        pos = copyHeaderSize + int(extension);
+        m_headerRead = true;
+    }
+
+    const int columns = m_types.size();
+    while (!m_atEnd && size - pos >= 2) {
+        const int rowStart = pos;
+        const qint16 count = qFromBigEndian<qint16>(data + pos);
+        pos += 2;
+
+        if (count == -1) {
+            m_atEnd = true;
+            break;
+        }
+
+        if (count != columns) {
+            setError(QStringLiteral("Binary COPY row has %1 columns, expected %2").arg(count).arg(columns));
+            return -1;
+        }
+
+        QVariantList row;
+        row.reserve(columns);
+        for (int i = 0; i < columns; ++i) {
+            if (size - pos < 4) {
+                return rowStart;
+            }
+
+            const qint32 length = qFromBigEndian<qint32>(data + pos);
+            pos += 4;
+            if (length == -1) {
+                row.append(QVariant());
+                continue;
+            } else if (length < 0) {
+                setError(QStringLiteral("Invalid binary COPY field length %1").arg(length));
+                return -1;
+            }
+
+            if (size - pos < length) {
+                return rowStart;
+            }
+
+            QVariant value;
+            if (!decode(i, data + pos, length, value)) {
+                return -1;
+            }
+            row.append(value);
+            pos += length;
+        }
+        m_rows.append(row);
+    }
+
+    return pos;
+}
+
+bool ACopyBinaryReader::decode(int column, const char *data, int size, QVariant &value)
+{
+    const quint32 type = m_types[column];
+    int expectedSize = -1;
+    switch (type) {
+    case Bool:
+        expectedSize = 1;
+        break;
+    case Int2:
+        expectedSize = 2;
+        break;
+    case Int4:
+    case Oid:
+    case Float4:
+    case Date:
+        expectedSize = 4;
+        break;
+    case Int8:
+    case Float8:
+    case Time:
+    case Timestamp:
+    case TimestampTz:
+        expectedSize = 8;
+        break;
+    case TimeTz:
+        expectedSize = 12;
+        break;
+    case Uuid:
+        expectedSize = 16;
+        break;
+    default:
+        break;
+    }
+
+    if (expectedSize != -1 && size != expectedSize) {
+        setError(QStringLiteral("Invalid binary COPY data size %1 for column %2 of type %3")
+                 .arg(size).arg(m_columnNames.value(column)).arg(type));
+        return false;
+    }
+
+    switch (type) {
+    case Bool:
+        value = data[0] != 0;
+        break;
+    case Int2:
+        value = int(qFromBigEndian<qint16>(data));
+        break;
+    case Int4:
+        value = qFromBigEndian<qint32>(data);
+        break;
+    case Oid:
+        value = qint64(qFromBigEndian<quint32>(data));
+        break;
+    case Int8:
+        value = qint64(qFromBigEndian<qint64>(data));
+        break;
+    case Float4:
+    {
+        const quint32 bits = qFromBigEndian<quint32>(data);
+        float ret;
+        memcpy(&ret, &bits, sizeof(ret));
+        value = double(ret);
+        break;
+    }
+    case Float8:
+    {
+        const quint64 bits = qFromBigEndian<quint64>(data);
+        double ret;
+        memcpy(&ret, &bits, sizeof(ret));
+        value = ret;
+        break;
+    }
+    case Numeric:
+    {
+        double ret;
+        if (!decodeNumeric(data, size, ret)) {
+            setError(QStringLiteral("Invalid binary numeric for column %1").arg(m_columnNames.value(column)));
+            return false;
+        }
+        value = ret;
+        break;
+    }
+    case Date:
+    {
+        const qint32 days = qFromBigEndian<qint32>(data);
+        if (days == std::numeric_limits<qint32>::max() || days == std::numeric_limits<qint32>::min()) {
+            // infinity
+            value = QDate();
+        } else {
+            value = QDate(2000, 1, 1).addDays(days);
+        }
+        break;
+    }
+    case Time:
+    case TimeTz:
+        value = QTime::fromMSecsSinceStartOfDay(int(qFromBigEndian<qint64>(data) / 1000));
+        break;
+    case Timestamp:
+    case TimestampTz:
+    {
+        const qint64 usecs = qFromBigEndian<qint64>(data);
+        if (usecs == std::numeric_limits<qint64>::max() || usecs == std::numeric_limits<qint64>::min()) {
+            // infinity
+            value = QDateTime();
+        } else if (type == TimestampTz) {
+            value = QDateTime::fromMSecsSinceEpoch(pgEpochMSecs + floorDiv(usecs, 1000), Qt::UTC);
+        } else {
+            // Like the text format, timestamps without time zone are local time
+            const qint64 days = floorDiv(usecs, usecsPerDay);
+            const qint64 timeUsecs = usecs - days * usecsPerDay;
+            value = QDateTime(QDate(2000, 1, 1).addDays(days), QTime::fromMSecsSinceStartOfDay(int(timeUsecs / 1000)));
+        }
+        break;
+    }
+    case Uuid:
+        value = QUuid::fromRfc4122(QByteArray::fromRawData(data, size)).toString(QUuid::WithoutBraces);
+        break;
+    case Jsonb:
+        // The first byte is the jsonb format version
+        if (size < 1 || data[0] != 1) {
+            setError(QStringLiteral("Unsupported jsonb version for column %1").arg(m_columnNames.value(column)));
+            return false;
+        }
+        value = QString::fromUtf8(data + 1, size - 1);
+        break;
+    case Name:
+    case Text:
+    case Json:
+    case Bpchar:
+    case Varchar:
+        value = QString::fromUtf8(data, size);
+        break;
+    default:
+        value = QByteArray(data, size);
+    }
+
+    return true;
+}
+
+void ACopyBinaryReader::setError(const QString &error)
+{
+    qWarning(ASQL_COPY) << error;
+    m_error = true;
+    m_errorString = error;
+}
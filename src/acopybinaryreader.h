@@ -0,0 +1,136 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ACOPYBINARYREADER_H
+#define ACOPYBINARYREADER_H
+
+#include <QStringList>
+#include <QVector>
+
+#include <adatabase.h>
+#include <aresult.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+/*!
+ * \brief The ACopyBinaryReader class decodes the PostgreSQL binary COPY format
+ *
+ * Binary COPY is the fastest way to get rows out of PostgreSQL, the data
+ * produced by COPY (query) TO STDOUT (FORMAT binary) doesn't carry the column
+ * types, so they must be given in the same order as the query columns.
+ *
+ * Values are decoded to the same QVariant types AResult::value() returns
+ * for the text format, columns of unknown types are returned as raw QByteArray.
+ *
+ * \code{.cpp}
+ * ACopyBinaryReader::copy(db, QStringLiteral("SELECT id, name, created_at FROM users"),
+ *                         {QStringLiteral("id"), QStringLiteral("name"), QStringLiteral("created_at")},
+ *                         {ACopyBinaryReader::Int8, ACopyBinaryReader::Text, ACopyBinaryReader::TimestampTz},
+ *                         [] (AResult &rows) {
+ *     // called for every batch, the last one has lastResulSet() set
+ * });
+ * \endcode
+ */
+class ASQL_PG_EXPORT ACopyBinaryReader
+{
+public:
+    /*!
+     * \brief The Type enum has the OIDs of the supported PostgreSQL types
+     */
+    enum Type : quint32 {
+        Bool = 16,
+        Bytea = 17,
+        Name = 19,
+        Int8 = 20,
+        Int2 = 21,
+        Int4 = 23,
+        Text = 25,
+        Oid = 26,
+        Json = 114,
+        Float4 = 700,
+        Float8 = 701,
+        Bpchar = 1042,
+        Varchar = 1043,
+        Date = 1082,
+        Time = 1083,
+        Timestamp = 1114,
+        TimestampTz = 1184,
+        TimeTz = 1266,
+        Numeric = 1700,
+        Uuid = 2950,
+        Jsonb = 3802,
+    };
+
+    /*!
+     * \brief ACopyBinaryReader constructs a new reader
+     * \param columnNames names given to the decoded columns
+     * \param types the PostgreSQL type OID of each column, \sa Type
+     */
+    ACopyBinaryReader(const QStringList &columnNames, const QVector<quint32> &types);
+
+    /*!
+     * \brief feed decodes all complete rows in \p data, incomplete rows
+     * are kept until the rest of the data arrives
+     * \param data
+     * \return false on error
+     */
+    bool feed(const QByteArray &data);
+
+    /*!
+     * \brief atEnd returns true once the COPY trailer was read
+     */
+    bool atEnd() const;
+
+    bool error() const;
+    QString errorString() const;
+
+    /*!
+     * \brief rowsAvailable returns the number of decoded rows not yet taken
+     */
+    int rowsAvailable() const;
+
+    /*!
+     * \brief takeRows returns the decoded rows as an AResult and clears them
+     * \param lastResultSet value of AResult::lastResulSet() for the returned result
+     */
+    AResult takeRows(bool lastResultSet = false);
+
+    /*!
+     * \brief takeColumns returns the decoded rows as columnar batch,
+     * one list of values per column, and clears them
+     */
+    QVector<QVariantList> takeColumns();
+
+    /*!
+     * \brief copy runs COPY (\p query) TO STDOUT (FORMAT binary) on \p db and calls \p cb
+     * with batches of up to \p batchRows decoded rows
+     *
+     * The last call has AResult::lastResulSet() set, errors from the server or
+     * the decoder are delivered as an AResult with error set.
+     */
+    static void copy(ADatabase db, const QString &query, const QStringList &columnNames, const QVector<quint32> &types,
+                     AResultFn cb, QObject *receiver = nullptr, int batchRows = 1000);
+
+private:
+    int parse(const char *data, int size);
+    bool decode(int column, const char *data, int size, QVariant &value);
+    void setError(const QString &error);
+
+    QStringList m_columnNames;
+    QVector<quint32> m_types;
+    QVector<int> m_metaTypes;
+    QVector<QVariantList> m_rows;
+    QByteArray m_buffer;
+    QString m_errorString;
+    bool m_headerRead = false;
+    bool m_atEnd = false;
+    bool m_error = false;
+};
+
+}
+
+#endif // ACOPYBINARYREADER_H
@@ -7,7 +7,14 @@
 
 #include "adriver.h"
 #include "adriverfactory.h"
-
+#include "aresult.h"
+
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
 #include <QLoggingCategory>
 
 using namespace ASql;
@@ -121,12 +128,290 @@ void ADatabase::exec(const APreparedQuery &query, const QVariantList &params, AR
     d->exec(d, query, params, cb, receiver);
 }
 
+void ADatabase::copyTo(const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver)
+{
+    Q_ASSERT(d);
+    d->copyTo(d, query, dataCb, cb, receiver);
+}
+
+void ADatabase::copyFrom(const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver)
+{
+    Q_ASSERT(d);
+    d->copyFrom(d, query, producer, cb, receiver);
+}
+
+static QString quoteIdentifier(const QString &identifier)
+{
+    QString ret = identifier;
+    ret.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + ret + QLatin1Char('"');
+}
+
+static QString quoteTable(const QString &table)
+{
+    const int dot = table.indexOf(QLatin1Char('.'));
+    if (dot == -1) {
+        return quoteIdentifier(table);
+    }
+    return quoteIdentifier(table.left(dot)) + QLatin1Char('.') + quoteIdentifier(table.mid(dot + 1));
+}
+
+/*
+ * Appends the value using the COPY text format
+ */
+static void appendCopyText(QByteArray &out, const QVariant &value)
+{
+    if (value.isNull()) {
+        out.append("\\N");
+        return;
+    }
+
+    QByteArray text;
+    switch (value.userType()) {
+    case QMetaType::Bool:
+        out.append(value.toBool() ? 't' : 'f');
+        return;
+    case QMetaType::QByteArray:
+        // bytea hex format, with the backslash escaped
+        out.append("\\\\x");
+        out.append(value.toByteArray().toHex());
+        return;
+    case QMetaType::Double:
+    {
+        const double number = value.toDouble();
+        if (qIsNaN(number)) {
+            out.append("NaN");
+        } else if (qIsInf(number)) {
+            out.append(number > 0 ? "Infinity" : "-Infinity");
+        } else {
+            out.append(QByteArray::number(number, 'g', 17));
+        }
+        return;
+    }
+    case QMetaType::QTime:
+        text = value.toTime().toString(Qt::ISODateWithMs).toLatin1();
+        break;
+    case QMetaType::QDateTime:
+        text = value.toDateTime().toString(Qt::ISODateWithMs).toLatin1();
+        break;
+    case QMetaType::QJsonValue:
+    case QMetaType::QJsonObject:
+    case QMetaType::QJsonArray:
+    {
+        const QJsonValue json = QJsonValue::fromVariant(value);
+        if (json.isObject()) {
+            text = QJsonDocument(json.toObject()).toJson(QJsonDocument::Compact);
+        } else if (json.isArray()) {
+            text = QJsonDocument(json.toArray()).toJson(QJsonDocument::Compact);
+        } else {
+            text = value.toString().toUtf8();
+        }
+        break;
+    }
+    case QMetaType::QJsonDocument:
+        text = value.toJsonDocument().toJson(QJsonDocument::Compact);
+        break;
+    default:
+        text = value.toString().toUtf8();
+    }
+
+    out.reserve(out.size() + text.size());
+    for (char c : qAsConst(text)) {
+        switch (c) {
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        default:
+            out.append(c);
+        }
+    }
+}
+
+void ADatabase::upsertBulk(const QString &table, const QStringList &columns, const QStringList &keyColumns,
+                           const QVector<QVariantList> &rows, AResultFn cb, QObject *receiver)
+{
+    Q_ASSERT(d);
+
+    struct UpsertState {
+        QVector<QVariantList> rows;
+        AResult error;
+        AResult inserted;
+        int nextRow = 0;
+        bool failed = false;
+    };
+    auto state = std::make_shared<UpsertState>();
+    state->rows = rows;
+
+    // Once a command fails the following ones fail as well, keep the first error
+    auto checkError = [state] (AResult &result) {
+        if (result.error() && !state->failed) {
+            state->failed = true;
+            state->error = result;
+        }
+    };
+
+    QStringList quotedColumns;
+    QStringList updates;
+    for (const QString &column : columns) {
+        const QString quoted = quoteIdentifier(column);
+        quotedColumns.append(quoted);
+        if (!keyColumns.contains(column)) {
+            updates.append(quoted + QLatin1String(" = EXCLUDED.") + quoted);
+        }
+    }
+
+    QStringList quotedKeys;
+    for (const QString &column : keyColumns) {
+        quotedKeys.append(quoteIdentifier(column));
+    }
+
+    const QString quotedTable = quoteTable(table);
+    const QString columnList = quotedColumns.join(QLatin1String(", "));
+
+    begin(checkError, receiver);
+
+    // Only column types are copied, constraints of columns not being set don't apply
+    exec(QLatin1String("CREATE TEMP TABLE asql_upsert_staging ON COMMIT DROP AS SELECT ") + columnList +
+         QLatin1String(" FROM ") + quotedTable + QLatin1String(" WITH NO DATA"), checkError, receiver);
+
+    copyFrom(QLatin1String("COPY asql_upsert_staging (") + columnList + QLatin1String(") FROM STDIN"), [state] {
+        QByteArray chunk;
+        while (state->nextRow < state->rows.size() && chunk.size() < 64 * 1024) {
+            const QVariantList &row = state->rows.at(state->nextRow++);
+            for (int i = 0; i < row.size(); ++i) {
+                if (i) {
+                    chunk.append('\t');
+                }
+                appendCopyText(chunk, row[i]);
+            }
+            chunk.append('\n');
+        }
+
+        if (state->nextRow == state->rows.size()) {
+            // Release the memory as soon as possible
+            state->rows.clear();
+            state->nextRow = 0;
+        }
+        return chunk;
+    }, checkError, receiver);
+
+    QString insert = QLatin1String("INSERT INTO ") + quotedTable + QLatin1String(" (") + columnList +
+            QLatin1String(") SELECT ") + columnList + QLatin1String(" FROM asql_upsert_staging ON CONFLICT (") +
+            quotedKeys.join(QLatin1String(", ")) + QLatin1Char(')');
+    if (updates.isEmpty()) {
+        insert += QLatin1String(" DO NOTHING");
+    } else {
+        insert += QLatin1String(" DO UPDATE SET ") + updates.join(QLatin1String(", "));
+    }
+    exec(insert, [state, checkError] (AResult &result) {
+        checkError(result);
+        state->inserted = result;
+    }, receiver);
+
+    // If anything failed COMMIT does a ROLLBACK
+    commit([state, cb] (AResult &result) {
+        if (!cb) {
+            return;
+        }
+
+        if (state->failed) {
+            cb(state->error);
+        } else if (result.error()) {
+            cb(result);
+        } else {
+            cb(state->inserted);
+        }
+    }, receiver);
+}
+
+void ADatabase::currentWalLsn(AResultFn cb, QObject *receiver)
+{
+    Q_ASSERT(d);
+    exec(u"SELECT pg_current_wal_lsn()::text AS lsn", cb, receiver);
+}
+
+/*
+ * Polls the replay position until it reaches the LSN, the poll interval
+ * starts small since most of the time replicas are only a few ms behind
+ */
+static void pollReplayLsn(ADatabase db, const QString &lsn, QDeadlineTimer deadline, int interval,
+                          AResultFn cb, QObject *receiver)
+{
+    // pg_last_wal_replay_lsn() is NULL on a primary which always has its own writes
+    db.exec(u"SELECT COALESCE(pg_last_wal_replay_lsn() >= $1::pg_lsn, true) AS reached", {lsn},
+            [=] (AResult &result) mutable {
+        if (result.error() || (result.size() && result.begin()[0].toBool()) || deadline.hasExpired()) {
+            if (cb) {
+                cb(result);
+            }
+            return;
+        }
+
+        // remainingTime() is -1 for a forever deadline
+        const int wait = deadline.isForever() ? interval
+                                              : int(qBound<qint64>(0, deadline.remainingTime(), interval));
+        auto poll = [=] {
+            pollReplayLsn(db, lsn, deadline, qMin(interval * 2, 100), cb, receiver);
+        };
+        if (receiver) {
+            QTimer::singleShot(wait, receiver, poll);
+        } else {
+            QTimer::singleShot(wait, poll);
+        }
+    }, receiver);
+}
+
+void ADatabase::waitForLsn(const QString &lsn, int timeoutMs, AResultFn cb, QObject *receiver)
+{
+    Q_ASSERT(d);
+    pollReplayLsn(*this, lsn, QDeadlineTimer(timeoutMs), 2, cb, receiver);
+}
+
 void ADatabase::setLastQuerySingleRowMode()
 {
     Q_ASSERT(d);
     d->setLastQuerySingleRowMode();
 }
 
+void ADatabase::setResultLimit(qint64 maxBytes, ResultLimitAction action, qint64 maxRows)
+{
+    Q_ASSERT(d);
+    d->setResultLimit(maxBytes, action, maxRows);
+}
+
+void ADatabase::setLastQueryResultLimit(qint64 maxBytes, ResultLimitAction action, qint64 maxRows)
+{
+    Q_ASSERT(d);
+    d->setLastQueryResultLimit(maxBytes, action, maxRows);
+}
+
+void ADatabase::setSessionParameter(const QString &name, const QString &value)
+{
+    Q_ASSERT(d);
+    d->setSessionParameter(name, value);
+}
+
+void ADatabase::setSessionParameters(const QHash<QString, QString> &parameters)
+{
+    Q_ASSERT(d);
+    d->setSessionParameters(parameters);
+}
+
+QHash<QString, QString> ADatabase::sessionParameters() const
+{
+    Q_ASSERT(d);
+    return d->sessionParameters();
+}
+
 void ADatabase::subscribeToNotification(const QString &channel, ANotificationFn cb, QObject *receiver)
 {
     Q_ASSERT(d);
@@ -6,8 +6,10 @@
 #ifndef ADATABASE_H
 #define ADATABASE_H
 
+#include <QHash>
 #include <QObject>
 #include <QVariantList>
+#include <QVector>
 
 #include <functional>
 #include <memory>
@@ -30,6 +32,8 @@ public:
 
 using AResultFn = std::function<void(AResult &row)>;
 using ANotificationFn = std::function<void(const ADatabaseNotification &payload)>;
+using ACopyDataFn = std::function<void(const QByteArray &data)>;
+using ACopyProducerFn = std::function<QByteArray()>;
 
 class APreparedQuery;
 class ASQL_EXPORT ADatabase
@@ -43,6 +47,12 @@ public:
     };
     Q_ENUM(State)
 
+    enum class ResultLimitAction {
+        Abort,
+        Stream
+    };
+    Q_ENUM(ResultLimitAction)
+
     /*!
      * \brief ADatabase contructs an invalid database object
      */
@@ -163,6 +173,10 @@ public:
      * once done AResult object will have the retrieved data if any, always
      * check for AResult::error() to see if the query was successful.
      *
+     * QVariantList and QStringList params are sent as arrays, and on Postgres "IN ($n)"
+     * is rewritten to "= ANY($n)" and "NOT IN ($n)" to "<> ALL($n)", so the statement
+     * doesn't change with the number of values.
+     *
      * \param query
      * \param params
      * \param cb
@@ -185,6 +199,76 @@ public:
      */
     void exec(const APreparedQuery &query, const QVariantList &params, AResultFn cb, QObject *receiver = nullptr);
 
+    /*!
+     * \brief copyTo executes a COPY ... TO STDOUT \p query, the data is
+     * delivered to \p dataCb as it arrives, once done \p cb is called
+     * with the final result, check for AResult::error() to see if the copy was successful.
+     *
+     * \note The data passed to \p dataCb is only valid during the call, copy it if
+     * it needs to be kept. For Postgres each call contains a single COPY data row.
+     *
+     * \param query
+     * \param dataCb
+     * \param cb
+     */
+    void copyTo(const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief copyFrom executes a COPY ... FROM STDIN \p query, \p producer is
+     * called whenever more data can be sent and must return the next chunk of data,
+     * an empty QByteArray ends the COPY. Once done \p cb is called with the final
+     * result, always check for AResult::error() to see if the copy was successful.
+     *
+     * If \p receiver is deleted while the data is being sent the COPY is aborted.
+     *
+     * \param query
+     * \param producer
+     * \param cb
+     */
+    void copyFrom(const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief upsertBulk inserts or updates \p rows of \p table in a single transaction
+     *
+     * A temporary staging table is created with the same column types, the rows are sent
+     * using COPY and then merged into \p table with a single
+     * INSERT ... ON CONFLICT (\p keyColumns) DO UPDATE, this is much faster than upserting
+     * row by row and produces less WAL than deleting and inserting.
+     *
+     * \note This must not be called inside a transaction, key values must be unique within \p rows.
+     *
+     * \param table table name, it may be schema qualified, it and the column names are quoted
+     * \param columns the columns of each row
+     * \param keyColumns columns of the unique constraint or primary key used to detect conflicts
+     * \param rows each row must have a value for each of \p columns
+     * \param cb called once done, with the number of upserted rows in AResult::numRowsAffected()
+     */
+    void upsertBulk(const QString &table, const QStringList &columns, const QStringList &keyColumns,
+                    const QVector<QVariantList> &rows, AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief currentWalLsn retrieves the current write-ahead log position of the server,
+     * available as text in the "lsn" column of the result
+     *
+     * Queued right after a commit it returns a position that includes the committed
+     * writes, which can then be given to \sa waitForLsn() on a replica connection.
+     *
+     * \param cb
+     */
+    void currentWalLsn(AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief waitForLsn waits until this replica connection has replayed the write-ahead log up to \p lsn
+     *
+     * The replay position is polled until it reaches \p lsn or \p timeoutMs expires, the result
+     * has a boolean "reached" column that is false on timeout. On a primary it's reached at once.
+     *
+     * \param lsn a position returned by \sa currentWalLsn()
+     * \param timeoutMs
+     * \param cb
+     */
+    void waitForLsn(const QString &lsn, int timeoutMs, AResultFn cb, QObject *receiver = nullptr);
+
     /**
      * @brief setSingleRowMode
      *
@@ -192,6 +276,62 @@ public:
      */
     void setLastQuerySingleRowMode();
 
+    /*!
+     * \brief setResultLimit limits the memory used by the results of all queries
+     * sent after this call on this connection
+     *
+     * Queries are then executed in chunked rows mode, or single row mode with libpq
+     * older than 17, and rows are accumulated until the result is complete, the callback
+     * then receives all rows at once, without copying them. If the accumulated rows
+     * exceed \p maxBytes or \p maxRows the query is either canceled and the callback
+     * receives an error, or with ResultLimitAction::Stream the callback receives the
+     * rows as they arrive, one chunk at a time, as if \sa setLastQuerySingleRowMode() was used.
+     *
+     * \param maxBytes maximum result size, 0 disables the limit
+     * \param action
+     * \param maxRows maximum number of rows, 0 disables the limit
+     */
+    void setResultLimit(qint64 maxBytes, ResultLimitAction action = ResultLimitAction::Abort, qint64 maxRows = 0);
+
+    /*!
+     * \brief setLastQueryResultLimit same as \sa setResultLimit() but only for the last sent or queued query.
+     * \param maxBytes maximum result size, 0 disables the limit
+     * \param action
+     * \param maxRows maximum number of rows, 0 disables the limit
+     */
+    void setLastQueryResultLimit(qint64 maxBytes, ResultLimitAction action = ResultLimitAction::Abort, qint64 maxRows = 0);
+
+    /*!
+     * \brief setSessionParameter declares the value of a run-time parameter, like "role" or "search_path",
+     * for the queries sent after this call
+     *
+     * Parameters are not sent right away, before each query the driver compares the declared
+     * parameters with the ones already set on the connection and only sends the differences,
+     * for simple queries in the same round trip as the query. Queries with parameters and
+     * prepared queries use the extended protocol, which takes a single command, so the
+     * differences are sent right before them at the cost of an extra round trip. A null
+     * \p value resets the parameter to its default.
+     *
+     * \note Changing the same parameters with SET commands on this connection confuses the
+     * tracking, use this method or \sa APool::setSessionParameters() instead.
+     *
+     * \param name
+     * \param value
+     */
+    void setSessionParameter(const QString &name, const QString &value);
+
+    /*!
+     * \brief setSessionParameters replaces all declared run-time parameters,
+     * parameters not in \p parameters are reset to their defaults
+     * \param parameters
+     */
+    void setSessionParameters(const QHash<QString, QString> &parameters);
+
+    /*!
+     * \brief sessionParameters returns the declared run-time parameters
+     */
+    QHash<QString, QString> sessionParameters() const;
+
     /*!
      * \brief subscribeToNotification will start listening for notifications
      * described by name
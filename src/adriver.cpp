@@ -54,6 +54,16 @@ QString ADriver::connectionInfo() const
     return m_info;
 }
 
+void ADriver::setConnectionLimiter(const std::shared_ptr<AConnectionLimiter> &limiter)
+{
+    m_connectionLimiter = limiter;
+}
+
+std::shared_ptr<AConnectionLimiter> ADriver::connectionLimiter() const
+{
+    return m_connectionLimiter;
+}
+
 bool ADriver::isValid() const
 {
     return false;
@@ -147,11 +157,65 @@ void ADriver::exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &que
     }
 }
 
+void ADriver::copyTo(const std::shared_ptr<ADriver> &db, const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver)
+{
+    Q_UNUSED(db)
+    Q_UNUSED(query)
+    Q_UNUSED(dataCb)
+    Q_UNUSED(receiver)
+    if (cb) {
+        AResult result(std::shared_ptr<AResultInvalid>(new AResultInvalid));
+        cb(result);
+    }
+}
+
+void ADriver::copyFrom(const std::shared_ptr<ADriver> &db, const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver)
+{
+    Q_UNUSED(db)
+    Q_UNUSED(query)
+    Q_UNUSED(producer)
+    Q_UNUSED(receiver)
+    if (cb) {
+        AResult result(std::shared_ptr<AResultInvalid>(new AResultInvalid));
+        cb(result);
+    }
+}
+
 void ADriver::setLastQuerySingleRowMode()
 {
 
 }
 
+void ADriver::setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows)
+{
+    Q_UNUSED(maxBytes)
+    Q_UNUSED(action)
+    Q_UNUSED(maxRows)
+}
+
+void ADriver::setLastQueryResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows)
+{
+    Q_UNUSED(maxBytes)
+    Q_UNUSED(action)
+    Q_UNUSED(maxRows)
+}
+
+void ADriver::setSessionParameters(const QHash<QString, QString> &parameters)
+{
+    Q_UNUSED(parameters)
+}
+
+void ADriver::setSessionParameter(const QString &name, const QString &value)
+{
+    Q_UNUSED(name)
+    Q_UNUSED(value)
+}
+
+QHash<QString, QString> ADriver::sessionParameters() const
+{
+    return {};
+}
+
 void ADriver::subscribeToNotification(const std::shared_ptr<ADriver> &db, const QString &name, ANotificationFn cb, QObject *receiver)
 {
     Q_UNUSED(db)
@@ -6,6 +6,7 @@
 #ifndef ADRIVER_H
 #define ADRIVER_H
 
+#include <QHash>
 #include <QString>
 #include <QSocketNotifier>
 
@@ -19,6 +20,7 @@ namespace ASql {
 
 class AResult;
 class APreparedQuery;
+class AConnectionLimiter;
 class ASQL_EXPORT ADriver : public QObject
 {
     Q_OBJECT
@@ -29,6 +31,9 @@ public:
 
     QString connectionInfo() const;
 
+    void setConnectionLimiter(const std::shared_ptr<AConnectionLimiter> &limiter);
+    std::shared_ptr<AConnectionLimiter> connectionLimiter() const;
+
     virtual bool isValid() const;
     virtual void open(std::function<void(bool isOpen, const QString &error)> cb);
 
@@ -45,14 +50,26 @@ public:
     virtual void exec(const std::shared_ptr<ADriver> &driver, QStringView query, const QVariantList &params, AResultFn cb, QObject *receiver);
     virtual void exec(const std::shared_ptr<ADriver> &driver, const APreparedQuery &query, const QVariantList &params, AResultFn cb, QObject *receiver);
 
+    virtual void copyTo(const std::shared_ptr<ADriver> &driver, const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver);
+
+    virtual void copyFrom(const std::shared_ptr<ADriver> &driver, const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver);
+
     virtual void setLastQuerySingleRowMode();
 
+    virtual void setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows);
+    virtual void setLastQueryResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows);
+
+    virtual void setSessionParameters(const QHash<QString, QString> &parameters);
+    virtual void setSessionParameter(const QString &name, const QString &value);
+    virtual QHash<QString, QString> sessionParameters() const;
+
     virtual void subscribeToNotification(const std::shared_ptr<ADriver> &driver, const QString &name, ANotificationFn cb, QObject *receiver);
     virtual QStringList subscribedToNotifications() const;
     virtual void unsubscribeFromNotification(const std::shared_ptr<ADriver> &driver, const QString &name);
 
 private:
     QString m_info;
+    std::shared_ptr<AConnectionLimiter> m_connectionLimiter;
 };
 
 }
@@ -3,6 +3,7 @@
  * SPDX-License-Identifier: MIT
  */
 #include "adriverfactory.h"
+#include "aconnectionlimiter.h"
 
 #include <adatabase.h>
 
@@ -28,4 +29,25 @@ ADatabase ADriverFactory::createDatabase() const
     return {};
 }
 
+void ADriverFactory::setConnectionRateLimit(double connectionsPerSecond, int burst)
+{
+    if (!m_connectionLimiter) {
+        m_connectionLimiter = std::make_shared<AConnectionLimiter>();
+    }
+    m_connectionLimiter->setRate(connectionsPerSecond, burst);
+}
+
+void ADriverFactory::setMaxConcurrentConnects(int max)
+{
+    if (!m_connectionLimiter) {
+        m_connectionLimiter = std::make_shared<AConnectionLimiter>();
+    }
+    m_connectionLimiter->setMaxConcurrent(max);
+}
+
+std::shared_ptr<AConnectionLimiter> ADriverFactory::connectionLimiter() const
+{
+    return m_connectionLimiter;
+}
+
 ADriverFactory::~ADriverFactory() = default;
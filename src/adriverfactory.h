@@ -13,6 +13,7 @@ namespace ASql {
 
 class ADriver;
 class ADatabase;
+class AConnectionLimiter;
 class ASQL_EXPORT ADriverFactory
 {
 public:
@@ -22,6 +23,35 @@ public:
     virtual ADriver *createRawDriver() const;
     virtual std::shared_ptr<ADriver> createDriver() const;
     virtual ADatabase createDatabase() const;
+
+    /*!
+     * \brief setConnectionRateLimit limits how many connection attempts per second
+     * all drivers created by this factory can start, on all threads.
+     *
+     * Attempts above the limit are queued, which avoids an authentication storm
+     * when every pool reconnects at once after a failover.
+     *
+     * \param connectionsPerSecond 0 means unlimited
+     * \param burst number of attempts that can be started at once
+     */
+    void setConnectionRateLimit(double connectionsPerSecond, int burst = 1);
+
+    /*!
+     * \brief setMaxConcurrentConnects limits how many connection attempts can
+     * be in progress at the same time, 0 means unlimited.
+     *
+     * \param max
+     */
+    void setMaxConcurrentConnects(int max);
+
+    /*!
+     * \brief connectionLimiter returns the limiter shared by the drivers created
+     * by this factory, or null if no limit was set.
+     */
+    std::shared_ptr<AConnectionLimiter> connectionLimiter() const;
+
+private:
+    std::shared_ptr<AConnectionLimiter> m_connectionLimiter;
 };
 
 }
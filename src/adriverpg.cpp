@@ -6,6 +6,7 @@
 #include "adriverpg.h"
 
 #include "aresult.h"
+#include "aconnectionlimiter.h"
 
 #include <QLoggingCategory>
 #include <QThread>
@@ -15,10 +16,28 @@
 #include <QJsonArray>
 #include <QUrlQuery>
 #include <QUuid>
+#include <QRegularExpression>
+#include <QMap>
 #include <QtEndian>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QCborStreamWriter>
 
 #include <libpq-fe.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#endif
+
 Q_LOGGING_CATEGORY(ASQL_PG, "asql.pg", QtInfoMsg)
 
 // workaround for postgres defining their OIDs in a private header file
@@ -47,9 +66,22 @@ Q_LOGGING_CATEGORY(ASQL_PG, "asql.pg", QtInfoMsg)
 #define QUUIDOID 2950
 #define QBITOID 1560
 #define QVARBITOID 1562
+#define QBOOLARRAYOID 1000
+#define QBYTEAARRAYOID 1001
+#define QINT4ARRAYOID 1007
+#define QTEXTARRAYOID 1009
+#define QINT8ARRAYOID 1016
+#define QFLOAT8ARRAYOID 1022
+#define QUUIDARRAYOID 2951
 
 #define VARHDRSZ 4
 
+#define RESOLVER_CACHE_TTL_MS 30000
+#define RESOLVER_CACHE_MAX_HOSTS 256
+
+// Rows received at once by queries with a result limit
+#define RESULT_LIMIT_CHUNK_ROWS 1000
+
 using namespace ASql;
 
 ADriverPg::ADriverPg(const QString &connInfo) : ADriver(connInfo)
@@ -59,9 +91,11 @@ ADriverPg::ADriverPg(const QString &connInfo) : ADriver(connInfo)
 
 ADriverPg::~ADriverPg()
 {
+    clearLimitedRows();
     if (m_conn) {
         PQfinish(m_conn);
     }
+    releaseConnectionSlot();
 }
 
 bool ADriverPg::isValid() const
@@ -87,11 +121,255 @@ QString connectionStatus(ConnStatusType type) {
     }
 }
 
+namespace {
+
+struct AResolvedHost {
+    QByteArrayList addresses;
+    qint64 expires;
+};
+
+QMutex m_resolverMutex;
+QHash<QByteArray, AResolvedHost> m_resolverCache;
+
+bool needsLookup(const QByteArray &host)
+{
+    if (host.isEmpty() || host.startsWith('/') || host.startsWith('@')) {
+        return false; // Unix-domain socket
+    }
+
+    unsigned char buf[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, host.constData(), buf) != 1 && inet_pton(AF_INET6, host.constData(), buf) != 1;
+}
+
+bool cachedLookup(const QByteArray &host, QByteArrayList &addresses)
+{
+    QMutexLocker locker(&m_resolverMutex);
+    auto it = m_resolverCache.find(host);
+    if (it != m_resolverCache.end()) {
+        if (it->expires > QDateTime::currentMSecsSinceEpoch()) {
+            addresses = it->addresses;
+            return true;
+        }
+        m_resolverCache.erase(it);
+    }
+    return false;
+}
+
+void cacheLookup(const QByteArray &host, const QByteArrayList &addresses)
+{
+    QMutexLocker locker(&m_resolverMutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (m_resolverCache.size() >= RESOLVER_CACHE_MAX_HOSTS) {
+        // Drop expired hosts first, if all are still valid start over
+        auto it = m_resolverCache.begin();
+        while (it != m_resolverCache.end()) {
+            if (it->expires <= now) {
+                it = m_resolverCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (m_resolverCache.size() >= RESOLVER_CACHE_MAX_HOSTS) {
+            m_resolverCache.clear();
+        }
+    }
+    m_resolverCache.insert(host, {addresses, now + RESOLVER_CACHE_TTL_MS});
+}
+
+QByteArrayList lookup(const QByteArray &host)
+{
+    QByteArrayList ret;
+    if (cachedLookup(host, ret)) {
+        return ret;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.constData(), nullptr, &hints, &result) == 0) {
+        for (addrinfo *ai = result; ai; ai = ai->ai_next) {
+            char buf[INET6_ADDRSTRLEN];
+            if (getnameinfo(ai->ai_addr, ai->ai_addrlen, buf, sizeof(buf), nullptr, 0, NI_NUMERICHOST) == 0) {
+                const QByteArray address(buf);
+                if (!ret.contains(address)) {
+                    ret.append(address);
+                }
+            }
+        }
+        freeaddrinfo(result);
+    }
+
+    if (!ret.isEmpty()) {
+        cacheLookup(host, ret);
+    }
+    return ret;
+}
+
+class AHostLookup : public QRunnable
+{
+public:
+    std::function<void()> fn;
+
+    void run() override { fn(); }
+};
+
+}
+
+/*!
+ * Adds the resolved addresses as hostaddr entries, each address gets
+ * it's own host entry so libpq can still try all of them, returns
+ * false if some host could not be resolved.
+ */
+static bool applyResolvedHosts(QByteArrayList &keywords, QByteArrayList &values, const QVector<QByteArrayList> &resolved)
+{
+    const int hostIndex = keywords.indexOf("host");
+    const int portIndex = keywords.indexOf("port");
+    const QByteArrayList hosts = values[hostIndex].split(',');
+    const QByteArrayList ports = portIndex != -1 ? values[portIndex].split(',') : QByteArrayList();
+
+    QByteArrayList newHosts;
+    QByteArrayList newHostAddrs;
+    QByteArrayList newPorts;
+    for (int i = 0; i < hosts.size(); ++i) {
+        const QByteArrayList &addresses = resolved[i];
+        if (needsLookup(hosts[i]) && addresses.isEmpty()) {
+            return false;
+        }
+
+        // Unix-domain sockets and IP addresses have an empty hostaddr entry
+        const QByteArrayList entries = addresses.isEmpty() ? QByteArrayList{QByteArray()} : addresses;
+        for (const QByteArray &address : entries) {
+            newHosts.append(hosts[i]);
+            newHostAddrs.append(address);
+            if (ports.size() > 1) {
+                newPorts.append(ports.value(i));
+            }
+        }
+    }
+
+    values[hostIndex] = newHosts.join(',');
+    if (ports.size() > 1) {
+        values[portIndex] = newPorts.join(',');
+    }
+    keywords.append("hostaddr");
+    values.append(newHostAddrs.join(','));
+    return true;
+}
+
 void ADriverPg::open(std::function<void(bool, const QString &)> cb)
 {
     qDebug(ASQL_PG) << "Open" << connectionInfo();
 
-    m_conn = PQconnectStart(connectionInfo().toUtf8().constData());
+    auto limiter = connectionLimiter();
+    if (limiter) {
+        m_state = ADatabase::State::Connecting;
+        limiter->acquire(this, [this, cb] {
+            m_connectionSlot = true;
+            openConnection(cb);
+        });
+        return;
+    }
+
+    openConnection(cb);
+}
+
+void ADriverPg::openConnection(std::function<void(bool, const QString &)> cb)
+{
+    char *errmsg = nullptr;
+    PQconninfoOption *options = PQconninfoParse(connectionInfo().toUtf8().constData(), &errmsg);
+    if (!options) {
+        const QString error = errmsg ? QString::fromLocal8Bit(errmsg) : QStringLiteral("PQconninfoParse failed");
+        PQfreemem(errmsg);
+        m_state = ADatabase::State::Disconnected;
+        releaseConnectionSlot();
+        if (cb) {
+            cb(false, error);
+        }
+        return;
+    }
+
+    QByteArrayList keywords;
+    QByteArrayList values;
+    for (PQconninfoOption *option = options; option->keyword; ++option) {
+        if (option->val) {
+            keywords.append(option->keyword);
+            values.append(option->val);
+        }
+    }
+    PQconninfoFree(options);
+
+    // libpq would resolve host names with a blocking getaddrinfo() call,
+    // so resolve them on a worker thread and give libpq the addresses
+    const int hostIndex = keywords.indexOf("host");
+    if (hostIndex == -1 || keywords.contains("hostaddr")) {
+        startConnection(keywords, values, cb);
+        return;
+    }
+
+    const QByteArrayList hosts = values[hostIndex].split(',');
+    QVector<QByteArrayList> resolved(hosts.size());
+    bool cached = true;
+    for (int i = 0; i < hosts.size(); ++i) {
+        if (needsLookup(hosts[i]) && !cachedLookup(hosts[i], resolved[i])) {
+            cached = false;
+        }
+    }
+
+    if (cached) {
+        startResolvedConnection(keywords, values, resolved, cb);
+        return;
+    }
+
+    m_state = ADatabase::State::Connecting;
+
+    // The context is deleted on this thread even if the lookup outlives the driver
+    std::shared_ptr<QObject> context(new QObject, [] (QObject *obj) { obj->deleteLater(); });
+    QPointer<ADriverPg> self(this);
+    auto job = new AHostLookup;
+    job->fn = [=] {
+        QVector<QByteArrayList> addresses(hosts.size());
+        for (int i = 0; i < hosts.size(); ++i) {
+            if (needsLookup(hosts[i])) {
+                addresses[i] = lookup(hosts[i]);
+            }
+        }
+
+        QMetaObject::invokeMethod(context.get(), [self, keywords, values, addresses, cb, context] {
+            if (self) {
+                self->startResolvedConnection(keywords, values, addresses, cb);
+            }
+        }, Qt::QueuedConnection);
+    };
+    QThreadPool::globalInstance()->start(job);
+}
+
+void ADriverPg::startResolvedConnection(const QByteArrayList &keywords, const QByteArrayList &values, const QVector<QByteArrayList> &resolved, std::function<void(bool, const QString &)> cb)
+{
+    QByteArrayList resolvedKeywords = keywords;
+    QByteArrayList resolvedValues = values;
+    if (applyResolvedHosts(resolvedKeywords, resolvedValues, resolved)) {
+        startConnection(resolvedKeywords, resolvedValues, cb);
+    } else {
+        qDebug(ASQL_PG) << "Failed to resolve hosts, letting libpq resolve them" << values[keywords.indexOf("host")];
+        startConnection(keywords, values, cb);
+    }
+}
+
+void ADriverPg::startConnection(const QByteArrayList &keywords, const QByteArrayList &values, std::function<void(bool, const QString &)> cb)
+{
+    std::vector<const char *> keywordsPtr;
+    std::vector<const char *> valuesPtr;
+    for (int i = 0; i < keywords.size(); ++i) {
+        keywordsPtr.push_back(keywords[i].constData());
+        valuesPtr.push_back(values[i].constData());
+    }
+    keywordsPtr.push_back(nullptr);
+    valuesPtr.push_back(nullptr);
+
+    m_conn = PQconnectStartParams(keywordsPtr.data(), valuesPtr.data(), 0);
     if (m_conn) {
         const auto socket = PQsocket(m_conn);
         if (socket > 0) {
@@ -117,7 +395,13 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                     qDebug(ASQL_PG) << "PGRES_POLLING_OK 1" << type << m_writeNotify->isEnabled();
                     m_writeNotify->setEnabled(false);
                     qDebug(ASQL_PG) << "PGRES_POLLING_OK 2" << type << m_writeNotify->isEnabled();
+                    // Never let libpq block the event loop while sending large queries,
+                    // pending data is flushed once the socket is writable again
+                    if (PQsetnonblocking(m_conn, 1) != 0) {
+                        qWarning(ASQL_PG) << "Failed to set non-blocking mode" << QString::fromLocal8Bit(PQerrorMessage(m_conn));
+                    }
                     m_connected = true;
+                    releaseConnectionSlot();
                     if (cb) {
                         cb(true, QString());
                     }
@@ -132,6 +416,7 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                     const QString error = QString::fromLocal8Bit(PQerrorMessage(m_conn));
                     qDebug(ASQL_PG) << "PGRES_POLLING_FAILED" << type << error;
                     finishConnection();
+                    releaseConnectionSlot();
 
                     if (cb) {
                         cb(false, error);
@@ -150,9 +435,16 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                 m_writeNotify->setEnabled(false);
                 if (!m_connected) {
                     connFn();
-                } else if (m_flush) {
-                    m_flush = false;
-                    cmdFlush();
+                } else {
+                    if (m_flush) {
+                        m_flush = false;
+                        cmdFlush();
+                    }
+
+                    if (m_copyIn && !m_flush && writeCopyData()) {
+                        // The server might have answered while we were still sending
+                        readResults();
+                    }
                 }
             });
 
@@ -162,50 +454,13 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                     connFn();
                 } else {
                     if (PQconsumeInput(m_conn) == 1) {
-                        while (PQisBusy(m_conn) == 0) {
-                            PGresult *result = PQgetResult(m_conn);
-//                            qDebug(ASQL_PG) << "Not busy: RESULT" << result << "busy" << PQisBusy(m_conn) << m_queuedQueries.size();
-                            if (Q_UNLIKELY(result != nullptr)) {
-//                                int status = PQresultStatus(result);
-                                APGQuery &pgQuery = m_queuedQueries.head();
-//                                qDebug(ASQL_PG) << "RESULT" << result << "status" << status << PGRES_TUPLES_OK << "shared_ptr result" << pgQuery.result;
-                                if (pgQuery.result->m_result) {
-                                    // when we had already had a result it means we should emit the
-                                    // first one and keep waiting till a null result is returned
-                                    pgQuery.result->m_lastResultSet = false;
-                                    pgQuery.done();
-
-                                    // allocate a new result
-                                    pgQuery.result = std::make_shared<AResultPg>();
-                                }
-                                pgQuery.result->m_result = result;
-                                pgQuery.result->processResult();
-                            } else if (m_queuedQueries.size()) {
-                                APGQuery &pgQuery = m_queuedQueries.head();
-                                m_queryRunning = false;
-                                if (Q_UNLIKELY(pgQuery.prepared && pgQuery.preparing)) {
-                                    if (Q_UNLIKELY(pgQuery.result->error())) {
-                                        // PREPARE OR PREPARED QUERY ERROR
-                                        auto query = m_queuedQueries.dequeue();
-                                        nextQuery();
-                                        query.done();
-                                    } else {
-                                        // Query prepared
-                                        m_preparedQueries.append(pgQuery.preparedQuery.identification());
-                                        pgQuery.result = std::make_shared<AResultPg>();
-                                        pgQuery.preparing = false;
-                                        nextQuery();
-                                    }
-                                } else {
-                                    auto query = m_queuedQueries.dequeue();
-                                    nextQuery();
-                                    query.done();
-                                }
-                                break;
-                            } else {
-                                break;
-                            }
+                        if (m_flush) {
+                            // The server might be waiting for us to read before it accepts more data
+                            m_flush = false;
+                            cmdFlush();
                         }
+
+                        readResults();
 //                        qDebug(ASQL_PG) << "Not busy OUT" << this;
 
                         PGnotify *notify = nullptr;
@@ -222,7 +477,16 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                                     }
                                     const bool self = (notify->be_pid == PQbackendPID(m_conn)) ? true : false;
 //                                qDebug(ASQL_PG) << "NOTIFICATION" << self << name << payload;
-                                    it.value()(ADatabaseNotification{name, payload, self});
+                                    if (Q_UNLIKELY(AStallMonitor::isEnabled())) {
+                                        QElapsedTimer timer;
+                                        timer.start();
+                                        it.value()(ADatabaseNotification{name, payload, self});
+                                        AStallMonitor::record(QByteArray("NOTIFY ") + notify->relname,
+                                                              QLatin1String("notification/") + name,
+                                                              timer.nsecsElapsed());
+                                    } else {
+                                        it.value()(ADatabaseNotification{name, payload, self});
+                                    }
                                 }
                             } else {
                                 qWarning(ASQL_PG, "received notification for '%s' which isn't subscribed to.", qPrintable(name));
@@ -242,9 +506,19 @@ void ADriverPg::open(std::function<void(bool, const QString &)> cb)
                     }
                 }
             });
+        } else {
+            const QString error = QString::fromLocal8Bit(PQerrorMessage(m_conn));
+            finishConnection();
+            releaseConnectionSlot();
+            if (cb) {
+                cb(false, error);
+            }
+            setState(ADatabase::State::Disconnected, error);
         }
 //        qDebug(ASQL_PG) << "PG Socket" << m_conn << socket;
     } else {
+        m_state = ADatabase::State::Disconnected;
+        releaseConnectionSlot();
         if (cb) {
             cb(false, QStringLiteral("PQconnectStart failed"));
         }
@@ -294,37 +568,179 @@ void ADriverPg::queryConstructed(APGQuery &pgQuery)
     if (pgQuery.checkReceiver) {
         connect(pgQuery.checkReceiver, &QObject::destroyed, this, [=] (QObject *obj) {
             if (m_queryRunning && !m_queuedQueries.empty() && m_queuedQueries.head().checkReceiver == obj) {
-                PGcancel *cancel = PQgetCancel(m_conn);
-                char errbuf[256];
-                int ret = PQcancel(cancel, errbuf, 256);
-                if (ret == 1) {
-                    qDebug(ASQL_PG) << "PQcancel sent";
-                } else {
-                    qDebug(ASQL_PG) << "PQcancel failed" << ret << errbuf;
-                }
-                PQfreeCancel(cancel);
+                cancelRunningQuery();
             }
 //            qDebug(ASQL_PG) << "destroyed" << m_queryRunning << m_queuedQueries.empty() ;
         });
     }
 
+    pgQuery.maxResultSize = m_maxResultSize;
+    pgQuery.maxResultRows = m_maxResultRows;
+    pgQuery.resultLimitAction = m_resultLimitAction;
+    pgQuery.sessionParameters = m_sessionParameters;
     m_queuedQueries.append(pgQuery);
 
     if (m_queryRunning || !m_conn || !m_connected || m_queuedQueries.size() > 1) {
         return;
     }
 
-    if (pgQuery.params.isEmpty()) {
-        doExec(pgQuery);
-    } else {
-        doExecParams(pgQuery);
+    startQuery(m_queuedQueries.head());
+}
+
+static inline bool isListParam(const QVariant &value)
+{
+    return value.userType() == QMetaType::QVariantList || value.userType() == QMetaType::QStringList;
+}
+
+/*
+ * Returns a copy of the query where string literals, quoted identifiers
+ * and comments are blanked, so that matches found on it are in SQL code
+ * and their positions are valid on the original query
+ */
+static QString maskLiterals(const QString &query)
+{
+    QString ret = query;
+    const int size = query.size();
+    auto blank = [&ret] (int from, int to) {
+        for (int i = from; i < to; ++i) {
+            ret[i] = QLatin1Char(' ');
+        }
+    };
+
+    int i = 0;
+    while (i < size) {
+        const QChar c = query[i];
+        const QChar next = i + 1 < size ? query[i + 1] : QChar();
+        int end = i;
+        if (c == QLatin1Char('\'') || c == QLatin1Char('"')) {
+            // E'' strings accept backslash escapes, doubled quotes work for all of them
+            const bool escapes = c == QLatin1Char('\'') && i > 0 && query[i - 1].toLower() == QLatin1Char('e') &&
+                    (i == 1 || !query[i - 2].isLetterOrNumber());
+            end = i + 1;
+            while (end < size) {
+                if (escapes && query[end] == QLatin1Char('\\')) {
+                    end += 2;
+                } else if (query[end] == c) {
+                    if (end + 1 < size && query[end + 1] == c) {
+                        end += 2;
+                    } else {
+                        ++end;
+                        break;
+                    }
+                } else {
+                    ++end;
+                }
+            }
+        } else if (c == QLatin1Char('-') && next == QLatin1Char('-')) {
+            end = query.indexOf(QLatin1Char('\n'), i);
+            end = end == -1 ? size : end;
+        } else if (c == QLatin1Char('/') && next == QLatin1Char('*')) {
+            // Block comments nest in PostgreSQL
+            int depth = 0;
+            end = i;
+            while (end < size) {
+                const QChar second = end + 1 < size ? query[end + 1] : QChar();
+                if (query[end] == QLatin1Char('/') && second == QLatin1Char('*')) {
+                    ++depth;
+                    end += 2;
+                } else if (query[end] == QLatin1Char('*') && second == QLatin1Char('/')) {
+                    end += 2;
+                    if (--depth == 0) {
+                        break;
+                    }
+                } else {
+                    ++end;
+                }
+            }
+        } else if (c == QLatin1Char('$') && !next.isDigit() && (i == 0 || !(query[i - 1].isLetterOrNumber() || query[i - 1] == QLatin1Char('_')))) {
+            // Dollar quoted strings, $1 parameters can't be tags
+            int tagEnd = i + 1;
+            while (tagEnd < size && (query[tagEnd].isLetterOrNumber() || query[tagEnd] == QLatin1Char('_'))) {
+                ++tagEnd;
+            }
+            if (tagEnd < size && query[tagEnd] == QLatin1Char('$')) {
+                const QString tag = query.mid(i, tagEnd - i + 1);
+                end = query.indexOf(tag, tagEnd + 1);
+                end = end == -1 ? size : end + tag.size();
+            }
+        }
+
+        if (end > i) {
+            end = qMin(end, size);
+            blank(i, end);
+            i = end;
+        } else {
+            ++i;
+        }
     }
+    return ret;
+}
+
+/*
+ * Rewrites "IN ($n)" to "= ANY($n)" and "NOT IN ($n)" to "<> ALL($n)"
+ * when $n is a list, which is sent as an array so the statement is the
+ * same for any number of values
+ */
+static QString rewriteListParams(const QString &query, const QVariantList &params)
+{
+    const QString masked = maskLiterals(query);
+
+    // Replaced from the end so the positions of the earlier matches stay valid
+    QMap<int, QPair<int, QString>> replacements;
+    for (int i = 0; i < params.size(); ++i) {
+        if (!isListParam(params[i])) {
+            continue;
+        }
+
+        const QString param = QLatin1Char('$') + QString::number(i + 1);
+        const QString pattern = QLatin1String("\\b(NOT\\s+)?IN\\s*\\(\\s*\\$") + QString::number(i + 1) + QLatin1String("\\s*\\)");
+        QRegularExpressionMatchIterator it = QRegularExpression(pattern, QRegularExpression::CaseInsensitiveOption).globalMatch(masked);
+        while (it.hasNext()) {
+            const QRegularExpressionMatch match = it.next();
+            const QString replacement = match.capturedLength(1) ? QLatin1String("<> ALL(") + param + QLatin1Char(')')
+                                                                : QLatin1String("= ANY(") + param + QLatin1Char(')');
+            replacements.insert(match.capturedStart(), { match.capturedLength(), replacement });
+        }
+    }
+
+    QString ret = query;
+    for (auto it = replacements.constEnd(); it != replacements.constBegin();) {
+        --it;
+        ret.replace(it.key(), it.value().first, it.value().second);
+    }
+    return ret;
+}
+
+static bool hasListParams(const QVariantList &params)
+{
+    return std::any_of(params.cbegin(), params.cend(), isListParam);
+}
+
+/*
+ * A prepared statement is rewritten for the positions of its list
+ * parameters, so each shape is prepared under a name of its own
+ */
+static QByteArray preparedName(const APreparedQuery &query, const QVariantList &params)
+{
+    QByteArray ret = query.identification();
+    if (Q_LIKELY(!hasListParams(params))) {
+        return ret;
+    }
+
+    ret.append("_l");
+    for (int i = 0; i < params.size(); ++i) {
+        if (isListParam(params[i])) {
+            ret.append('_');
+            ret.append(QByteArray::number(i + 1));
+        }
+    }
+    return ret;
 }
 
 void ADriverPg::exec(const std::shared_ptr<ADriver> &db, const QString &query, const QVariantList &params, AResultFn cb, QObject *receiver)
 {
     APGQuery pgQuery;
-    pgQuery.query = query.toUtf8();
+    pgQuery.query = Q_UNLIKELY(hasListParams(params)) ? rewriteListParams(query, params).toUtf8() : query.toUtf8();
     pgQuery.params = params;
     pgQuery.cb = cb;
     selfDriver = db;
@@ -337,7 +753,7 @@ void ADriverPg::exec(const std::shared_ptr<ADriver> &db, const QString &query, c
 void ADriverPg::exec(const std::shared_ptr<ADriver> &db, QStringView query, const QVariantList &params, AResultFn cb, QObject *receiver)
 {
     APGQuery pgQuery;
-    pgQuery.query = query.toUtf8();
+    pgQuery.query = Q_UNLIKELY(hasListParams(params)) ? rewriteListParams(query.toString(), params).toUtf8() : query.toUtf8();
     pgQuery.params = params;
     pgQuery.cb = cb;
     selfDriver = db;
@@ -351,6 +767,7 @@ void ADriverPg::exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &q
 {
     APGQuery pgQuery;
     pgQuery.preparedQuery = query;
+    pgQuery.preparedName = preparedName(query, params);
     pgQuery.params = params;
     pgQuery.cb = cb;
     selfDriver = db;
@@ -361,6 +778,32 @@ void ADriverPg::exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &q
     queryConstructed(pgQuery);
 }
 
+void ADriverPg::copyTo(const std::shared_ptr<ADriver> &db, const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver)
+{
+    APGQuery pgQuery;
+    pgQuery.query = query.toUtf8();
+    pgQuery.cb = cb;
+    pgQuery.copyDataCb = dataCb;
+    selfDriver = db;
+    pgQuery.receiver = receiver;
+    pgQuery.checkReceiver = receiver;
+
+    queryConstructed(pgQuery);
+}
+
+void ADriverPg::copyFrom(const std::shared_ptr<ADriver> &db, const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver)
+{
+    APGQuery pgQuery;
+    pgQuery.query = query.toUtf8();
+    pgQuery.cb = cb;
+    pgQuery.copyProducerCb = producer;
+    selfDriver = db;
+    pgQuery.receiver = receiver;
+    pgQuery.checkReceiver = receiver;
+
+    queryConstructed(pgQuery);
+}
+
 void ADriverPg::setLastQuerySingleRowMode()
 {
     if (m_queuedQueries.size() == 1) {
@@ -375,6 +818,52 @@ void ADriverPg::setLastQuerySingleRowMode()
     }
 }
 
+void ADriverPg::setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows)
+{
+    m_maxResultSize = maxBytes;
+    m_maxResultRows = maxRows;
+    m_resultLimitAction = action;
+}
+
+void ADriverPg::setLastQueryResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows)
+{
+    if (m_queuedQueries.isEmpty()) {
+        return;
+    }
+
+    APGQuery &pgQuery = m_queuedQueries.last();
+    pgQuery.maxResultSize = maxBytes;
+    pgQuery.maxResultRows = maxRows;
+    pgQuery.resultLimitAction = action;
+    if (m_queuedQueries.size() == 1 && pgQuery.resultLimited() && !pgQuery.setSingleRow && !pgQuery.preparing && m_queryRunning) {
+        setRowsMode(pgQuery);
+    }
+}
+
+void ADriverPg::setSessionParameters(const QHash<QString, QString> &parameters)
+{
+    m_sessionParameters.clear();
+    for (auto it = parameters.constBegin(); it != parameters.constEnd(); ++it) {
+        if (!it.value().isNull()) {
+            m_sessionParameters.insert(it.key(), it.value());
+        }
+    }
+}
+
+void ADriverPg::setSessionParameter(const QString &name, const QString &value)
+{
+    if (value.isNull()) {
+        m_sessionParameters.remove(name);
+    } else {
+        m_sessionParameters.insert(name, value);
+    }
+}
+
+QHash<QString, QString> ADriverPg::sessionParameters() const
+{
+    return m_sessionParameters;
+}
+
 void ADriverPg::subscribeToNotification(const std::shared_ptr<ADriver> &db, const QString &name, ANotificationFn cb, QObject *receiver)
 {
     if (m_subscribedNotifications.contains(name)) {
@@ -416,11 +905,7 @@ void ADriverPg::nextQuery()
         if (pgQuery.checkReceiver && pgQuery.receiver.isNull()) {
             m_queuedQueries.dequeue();
         } else {
-            if (pgQuery.params.isEmpty()) {
-                doExec(pgQuery);
-            } else {
-                doExecParams(pgQuery);
-            }
+            startQuery(pgQuery);
         }
     }
 
@@ -429,6 +914,131 @@ void ADriverPg::nextQuery()
     }
 }
 
+void ADriverPg::startQuery(APGQuery &pgQuery)
+{
+    if (!pgQuery.sessionSetup && (!pgQuery.sessionParameters.isEmpty() || !m_sessionCurrent.isEmpty())) {
+        int commands;
+        const QByteArray setup = sessionSetup(pgQuery.sessionParameters, commands);
+        if (commands && pgQuery.params.isEmpty() && !pgQuery.prepared) {
+            // Sent on the same round trip, their results are discarded
+            pgQuery.sessionSetupQuery = setup;
+            pgQuery.sessionSetupResults = commands;
+        } else if (commands) {
+            // The extended protocol takes a single command, so they go right before it
+            // as a query of its own, at the cost of an extra round trip
+            APGQuery setupQuery;
+            setupQuery.query = setup;
+            setupQuery.checkReceiver = nullptr;
+            setupQuery.sessionSetup = true;
+            setupQuery.sessionSetupResults = commands;
+            m_queuedQueries.prepend(setupQuery);
+            doExec(m_queuedQueries.head());
+            return;
+        }
+    }
+
+    if (pgQuery.params.isEmpty()) {
+        doExec(pgQuery);
+    } else {
+        doExecParams(pgQuery);
+    }
+}
+
+static void appendParameterName(QByteArray &out, const QString &name)
+{
+    const QStringList parts = name.split(QLatin1Char('.'));
+    for (int i = 0; i < parts.size(); ++i) {
+        if (i) {
+            out.append('.');
+        }
+        out.append('"');
+        out.append(parts[i].toUtf8().replace('"', "\"\""));
+        out.append('"');
+    }
+}
+
+static void appendLiteral(QByteArray &out, const QString &value)
+{
+    out.append('\'');
+    out.append(value.toUtf8().replace('\'', "''"));
+    out.append('\'');
+}
+
+/*!
+ * Builds the commands that bring the connection to the declared run-time
+ * parameters, assuming they will succeed
+ */
+QByteArray ADriverPg::sessionSetup(const QHash<QString, QString> &parameters, int &commands)
+{
+    QByteArray ret;
+    commands = 0;
+
+    // Reset parameters are kept with a null value, as a rollback might restore them
+    for (auto it = m_sessionCurrent.begin(); it != m_sessionCurrent.end(); ++it) {
+        if (!parameters.contains(it.key()) && (!it.value().isNull() || m_sessionUnknown.contains(it.key()))) {
+            ret.append("RESET ");
+            appendParameterName(ret, it.key());
+            ret.append("; ");
+            ++commands;
+            it.value() = QString();
+            m_sessionUnknown.remove(it.key());
+        }
+    }
+
+    // set_config() is used as it parses list values like search_path
+    QByteArray setConfig;
+    for (auto param = parameters.constBegin(); param != parameters.constEnd(); ++param) {
+        auto current = m_sessionCurrent.constFind(param.key());
+        if (current != m_sessionCurrent.constEnd() && !current.value().isNull() && current.value() == param.value() &&
+                !m_sessionUnknown.contains(param.key())) {
+            continue;
+        }
+
+        setConfig.append(setConfig.isEmpty() ? "SELECT set_config(" : ", set_config(");
+        appendLiteral(setConfig, param.key());
+        setConfig.append(", ");
+        appendLiteral(setConfig, param.value());
+        setConfig.append(", false)");
+        m_sessionCurrent.insert(param.key(), param.value());
+        m_sessionUnknown.remove(param.key());
+    }
+
+    if (!setConfig.isEmpty()) {
+        ret.append(setConfig);
+        ret.append("; ");
+        ++commands;
+    }
+
+    return ret;
+}
+
+/*!
+ * Run-time parameters are transactional, when they might have been
+ * rolled back or reset they are sent again on the next query
+ */
+void ADriverPg::trackSessionState(PGresult *result)
+{
+    if (m_sessionCurrent.isEmpty() && m_sessionUnknown.isEmpty()) {
+        return;
+    }
+
+    const char *status = PQcmdStatus(result);
+    if (PQresultStatus(result) == PGRES_FATAL_ERROR ||
+            qstrncmp(status, "ROLLBACK", 8) == 0 ||
+            qstrncmp(status, "DISCARD", 7) == 0 ||
+            qstrcmp(status, "RESET") == 0) {
+        qDebug(ASQL_PG) << "Session parameters might have changed, resending" << status;
+        invalidateSessionState();
+    }
+}
+
+void ADriverPg::invalidateSessionState()
+{
+    for (auto it = m_sessionCurrent.constBegin(); it != m_sessionCurrent.constEnd(); ++it) {
+        m_sessionUnknown.insert(it.key());
+    }
+}
+
 void ADriverPg::finishConnection()
 {
     if (m_conn) {
@@ -438,6 +1048,13 @@ void ADriverPg::finishConnection()
 
     m_subscribedNotifications.clear();
     m_preparedQueries.clear();
+    m_sessionCurrent.clear();
+    m_sessionUnknown.clear();
+    clearLimitedRows();
+    m_copyOut = false;
+    m_copyIn = false;
+    m_copyInEnd = false;
+    m_copyInData.clear();
     m_connected = false;
     if (m_readNotify) {
         m_readNotify->setEnabled(false);
@@ -465,46 +1082,194 @@ void ADriverPg::finishQueries(const QString &error)
 void ADriverPg::doExec(APGQuery &pgQuery)
 {
     int ret;
+    // Single row mode applies to the query just sent, never to PQsendPrepare()
+    bool singleRow = false;
     if (pgQuery.prepared) {
-        if (m_preparedQueries.contains(pgQuery.preparedQuery.identification())) {
+        if (m_preparedQueries.contains(pgQuery.preparedName)) {
             ret = PQsendQueryPrepared(m_conn,
-                                      pgQuery.preparedQuery.identification().constData(),
+                                      pgQuery.preparedName.constData(),
                                       0,
                                       nullptr,
                                       nullptr,
                                       nullptr,
                                       0); // perhaps later use binary results
-            if (pgQuery.setSingleRow) {
-                setSingleRowMode();
-            }
+            singleRow = pgQuery.setSingleRow || pgQuery.resultLimited();
         } else {
             m_queuedQueries.head().preparing = true;
             ret = PQsendPrepare(m_conn,
-                                pgQuery.preparedQuery.identification().constData(),
+                                pgQuery.preparedName.constData(),
                                 pgQuery.preparedQuery.query().constData(),
                                 0,
                                 nullptr); // perhaps later use binary results
         }
+    } else if (Q_UNLIKELY(!pgQuery.sessionSetupQuery.isEmpty())) {
+        // The query text itself is left untouched
+        const QByteArray query = pgQuery.sessionSetupQuery + pgQuery.query;
+        pgQuery.sessionSetupQuery.clear();
+        ret = PQsendQuery(m_conn, query.constData());
+        singleRow = pgQuery.setSingleRow || pgQuery.resultLimited();
     } else {
         ret = PQsendQuery(m_conn, pgQuery.query.constData());
+        singleRow = pgQuery.setSingleRow || pgQuery.resultLimited();
     }
 
     if (ret == 1) {
         m_queryRunning = true;
-        if (pgQuery.setSingleRow) {
-            setSingleRowMode();
+        if (singleRow) {
+            setRowsMode(pgQuery);
         }
         cmdFlush();
     } else {
+        if (pgQuery.sessionSetup || pgQuery.sessionSetupResults) {
+            invalidateSessionState();
+        }
         pgQuery.result->m_error = true;
         pgQuery.result->m_errorString = QString::fromLocal8Bit(PQerrorMessage(m_conn));
-        m_queuedQueries.dequeue().done();
+        auto query = m_queuedQueries.dequeue();
+        if (query.sessionSetup && !m_queuedQueries.isEmpty()) {
+            // The query it was sent for fails with it, or it would be retried forever
+            auto failed = m_queuedQueries.dequeue();
+            failed.result = query.result;
+            query = failed;
+        }
+        query.done();
         if (m_queuedQueries.isEmpty()) {
             selfDriver = {};
         }
     }
 }
 
+static inline void appendInt32(QByteArray &data, qint32 value)
+{
+    char buffer[4];
+    qToBigEndian<qint32>(value, buffer);
+    data.append(buffer, 4);
+}
+
+/*
+ * Encodes the list in the binary array format, the element type
+ * comes from the values, mixed types are sent as text
+ */
+static Oid encodeArray(const QVariantList &list, QByteArray &data)
+{
+    int elementType = QMetaType::UnknownType;
+    bool hasNull = false;
+    for (const QVariant &item : list) {
+        if (item.isNull()) {
+            hasNull = true;
+            continue;
+        }
+
+        const int type = item.userType();
+        if (elementType == QMetaType::UnknownType) {
+            elementType = type;
+        } else if (elementType != type) {
+            if ((elementType == QMetaType::Int && type == QMetaType::LongLong) ||
+                    (elementType == QMetaType::LongLong && type == QMetaType::Int)) {
+                elementType = QMetaType::LongLong;
+            } else {
+                elementType = QMetaType::QString;
+            }
+        }
+    }
+
+    Oid arrayOid;
+    Oid elementOid;
+    switch (elementType) {
+    case QMetaType::Int:
+        arrayOid = QINT4ARRAYOID;
+        elementOid = QINT4OID;
+        break;
+    case QMetaType::LongLong:
+        arrayOid = QINT8ARRAYOID;
+        elementOid = QINT8OID;
+        break;
+    case QMetaType::Bool:
+        arrayOid = QBOOLARRAYOID;
+        elementOid = QBOOLOID;
+        break;
+    case QMetaType::Double:
+        arrayOid = QFLOAT8ARRAYOID;
+        elementOid = QFLOAT8OID;
+        break;
+    case QMetaType::QUuid:
+        arrayOid = QUUIDARRAYOID;
+        elementOid = QUUIDOID;
+        break;
+    case QMetaType::QByteArray:
+        arrayOid = QBYTEAARRAYOID;
+        elementOid = QBYTEAOID;
+        break;
+    default:
+        elementType = QMetaType::QString;
+        arrayOid = QTEXTARRAYOID;
+        elementOid = QTEXTOID;
+    }
+
+    // one dimension, null flag, element type, size and lower bound
+    appendInt32(data, 1);
+    appendInt32(data, hasNull ? 1 : 0);
+    appendInt32(data, qint32(elementOid));
+    appendInt32(data, list.size());
+    appendInt32(data, 1);
+
+    for (const QVariant &item : list) {
+        if (item.isNull()) {
+            appendInt32(data, -1);
+            continue;
+        }
+
+        switch (elementType) {
+        case QMetaType::Int:
+            appendInt32(data, 4);
+            appendInt32(data, item.toInt());
+            break;
+        case QMetaType::LongLong:
+        {
+            char buffer[8];
+            qToBigEndian<qint64>(item.toLongLong(), buffer);
+            appendInt32(data, 8);
+            data.append(buffer, 8);
+        }
+            break;
+        case QMetaType::Bool:
+            appendInt32(data, 1);
+            data.append(item.toBool() ? 0x01 : 0x00);
+            break;
+        case QMetaType::Double:
+        {
+            const double number = item.toDouble();
+            quint64 bits;
+            memcpy(&bits, &number, sizeof(bits));
+            char buffer[8];
+            qToBigEndian<quint64>(bits, buffer);
+            appendInt32(data, 8);
+            data.append(buffer, 8);
+        }
+            break;
+        case QMetaType::QUuid:
+            appendInt32(data, 16);
+            data.append(item.toUuid().toRfc4122());
+            break;
+        case QMetaType::QByteArray:
+        {
+            const QByteArray bytes = item.toByteArray();
+            appendInt32(data, bytes.size());
+            data.append(bytes);
+        }
+            break;
+        default:
+        {
+            const QByteArray text = item.toString().toUtf8();
+            appendInt32(data, text.size());
+            data.append(text);
+        }
+        }
+    }
+
+    return arrayOid;
+}
+
 void ADriverPg::doExecParams(APGQuery &pgQuery)
 {
     const QVariantList &params = pgQuery.params;
@@ -620,6 +1385,21 @@ void ADriverPg::doExecParams(APGQuery &pgQuery)
                 paramFormats[i] = 0;
                 data = v.toJsonDocument().toJson(QJsonDocument::Compact);
                 break;
+            case QMetaType::QVariantList:
+            case QMetaType::QStringList:
+            {
+                const QVariantList list = v.toList();
+                if (list.isEmpty()) {
+                    // Let the server infer the array type
+                    paramTypes[i] = 0;
+                    paramFormats[i] = 0;
+                    data = QByteArrayLiteral("{}");
+                } else {
+                    paramTypes[i] = encodeArray(list, data);
+                    paramFormats[i] = 1;
+                }
+            }
+                break;
             default:
                 paramTypes[i] = QUNKNOWNOID; // This allows PG to try to deduce the type
                 paramFormats[i] = 0;
@@ -644,22 +1424,26 @@ void ADriverPg::doExecParams(APGQuery &pgQuery)
 
     int ret;
     if (pgQuery.prepared) {
-        if (m_preparedQueries.contains(pgQuery.preparedQuery.identification())) {
+        if (m_preparedQueries.contains(pgQuery.preparedName)) {
             ret = PQsendQueryPrepared(m_conn,
-                                      pgQuery.preparedQuery.identification().constData(),
+                                      pgQuery.preparedName.constData(),
                                       params.size(),
                                       paramValues.get(),
                                       paramLengths.get(),
                                       paramFormats.get(),
                                       0); // perhaps later use binary results
-            if (pgQuery.setSingleRow) {
-                setSingleRowMode();
+            if (pgQuery.setSingleRow || pgQuery.resultLimited()) {
+                setRowsMode(pgQuery);
             }
         } else {
+            // Prepared for this shape of parameters, see preparedName()
+            const QByteArray query = Q_UNLIKELY(hasListParams(params)) ?
+                        rewriteListParams(QString::fromUtf8(pgQuery.preparedQuery.query()), params).toUtf8() :
+                        pgQuery.preparedQuery.query();
             m_queuedQueries.head().preparing = true;
             ret = PQsendPrepare(m_conn,
-                                pgQuery.preparedQuery.identification().constData(),
-                                pgQuery.preparedQuery.query().constData(),
+                                pgQuery.preparedName.constData(),
+                                query.constData(),
                                 params.size(),
                                 paramTypes.get()); // perhaps later use binary results
         }
@@ -672,8 +1456,8 @@ void ADriverPg::doExecParams(APGQuery &pgQuery)
                                 paramLengths.get(),
                                 paramFormats.get(),
                                 0); // perhaps later use binary results
-        if (pgQuery.setSingleRow) {
-            setSingleRowMode();
+        if (pgQuery.setSingleRow || pgQuery.resultLimited()) {
+            setRowsMode(pgQuery);
         }
     }
     cmdFlush();
@@ -690,6 +1474,281 @@ void ADriverPg::doExecParams(APGQuery &pgQuery)
     }
 }
 
+void ADriverPg::cancelRunningQuery()
+{
+    PGcancel *cancel = PQgetCancel(m_conn);
+    char errbuf[256];
+    int ret = PQcancel(cancel, errbuf, 256);
+    if (ret == 1) {
+        qDebug(ASQL_PG) << "PQcancel sent";
+    } else {
+        qDebug(ASQL_PG) << "PQcancel failed" << ret << errbuf;
+    }
+    PQfreeCancel(cancel);
+}
+
+void ADriverPg::queryResult(APGQuery &pgQuery, PGresult *result)
+{
+    if (pgQuery.result->m_result) {
+        // when we had already had a result it means we should emit the
+        // first one and keep waiting till a null result is returned
+        pgQuery.result->m_lastResultSet = false;
+        pgQuery.done();
+
+        // allocate a new result
+        pgQuery.result = std::make_shared<AResultPg>();
+    }
+    pgQuery.result->m_result = result;
+    pgQuery.result->processResult();
+}
+
+PGresult *ADriverPg::limitResult(APGQuery &pgQuery, PGresult *result)
+{
+    if (pgQuery.resultLimitExceeded) {
+        // Drain what arrives until the cancelation takes effect
+        PQclear(result);
+        return nullptr;
+    }
+
+    const ExecStatusType status = PQresultStatus(result);
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    if (status == PGRES_SINGLE_TUPLE || status == PGRES_TUPLES_CHUNK) {
+#else
+    if (status == PGRES_SINGLE_TUPLE) {
+#endif
+        m_limitedRows.append(result);
+        m_limitedRowsSize += qint64(PQresultMemorySize(result));
+        m_limitedRowsCount += PQntuples(result);
+        const bool sizeExceeded = pgQuery.maxResultSize && m_limitedRowsSize > pgQuery.maxResultSize;
+        if (sizeExceeded || (pgQuery.maxResultRows && m_limitedRowsCount > pgQuery.maxResultRows)) {
+            if (pgQuery.resultLimitAction == ADatabase::ResultLimitAction::Stream) {
+                qDebug(ASQL_PG) << "Result limit exceeded, streaming rows" << m_limitedRowsSize << m_limitedRowsCount;
+                // From now on rows are delivered as they arrive
+                pgQuery.setSingleRow = true;
+                const QVector<PGresult *> rows = m_limitedRows;
+                m_limitedRows.clear();
+                clearLimitedRows();
+                for (PGresult *row : rows) {
+                    queryResult(pgQuery, row);
+                }
+            } else {
+                qWarning(ASQL_PG) << "Result limit exceeded, aborting query" << m_limitedRowsSize << m_limitedRowsCount;
+                clearLimitedRows();
+                cancelRunningQuery();
+                pgQuery.resultLimitExceeded = true;
+                pgQuery.result->m_error = true;
+                pgQuery.result->m_errorString = sizeExceeded ? QStringLiteral("Result exceeded the limit of %1 bytes").arg(pgQuery.maxResultSize)
+                                                             : QStringLiteral("Result exceeded the limit of %1 rows").arg(pgQuery.maxResultRows);
+            }
+        }
+        return nullptr;
+    } else if (status == PGRES_TUPLES_OK && !m_limitedRows.isEmpty()) {
+        // Result set finished under the limit, the rows are delivered as they were received
+        // without copying them, the final result only has the columns and the command tag
+        queryResult(pgQuery, result);
+        pgQuery.result->setRows(m_limitedRows);
+        m_limitedRows.clear();
+        clearLimitedRows();
+        return nullptr;
+    }
+
+    clearLimitedRows();
+    return result;
+}
+
+void ADriverPg::clearLimitedRows()
+{
+    for (PGresult *row : qAsConst(m_limitedRows)) {
+        PQclear(row);
+    }
+    m_limitedRows.clear();
+    m_limitedRowsSize = 0;
+    m_limitedRowsCount = 0;
+}
+
+void ADriverPg::readResults()
+{
+    // While in COPY state PQgetResult() must not be called until all data is transfered
+    bool waitCopyData = Q_UNLIKELY(m_copyIn) || (Q_UNLIKELY(m_copyOut) && !readCopyData());
+    while (!waitCopyData && PQisBusy(m_conn) == 0) {
+        PGresult *result = PQgetResult(m_conn);
+//        qDebug(ASQL_PG) << "Not busy: RESULT" << result << "busy" << PQisBusy(m_conn) << m_queuedQueries.size();
+        if (Q_UNLIKELY(result != nullptr)) {
+//            int status = PQresultStatus(result);
+            APGQuery &pgQuery = m_queuedQueries.head();
+            if (Q_UNLIKELY(pgQuery.sessionSetupResults)) {
+                if (PQresultStatus(result) != PGRES_FATAL_ERROR) {
+                    // single row and chunked modes split the set_config() row into two results
+                    const ExecStatusType status = PQresultStatus(result);
+#ifdef LIBPQ_HAS_CHUNK_MODE
+                    if (status != PGRES_SINGLE_TUPLE && status != PGRES_TUPLES_CHUNK) {
+#else
+                    if (status != PGRES_SINGLE_TUPLE) {
+#endif
+                        --pgQuery.sessionSetupResults;
+                    }
+                    PQclear(result);
+                    continue;
+                }
+                // The remaining commands are not executed, deliver the error
+                pgQuery.sessionSetupResults = 0;
+            }
+
+            if (Q_UNLIKELY(PQresultStatus(result) == PGRES_COPY_OUT)) {
+                PQclear(result);
+                m_copyOut = true;
+                waitCopyData = !readCopyData();
+                continue;
+            } else if (Q_UNLIKELY(PQresultStatus(result) == PGRES_COPY_IN)) {
+                PQclear(result);
+                m_copyIn = true;
+                m_copyInEnd = false;
+                waitCopyData = !writeCopyData();
+                continue;
+            }
+
+//            qDebug(ASQL_PG) << "RESULT" << result << "status" << status << PGRES_TUPLES_OK << "shared_ptr result" << pgQuery.result;
+            trackSessionState(result);
+            if (Q_UNLIKELY(pgQuery.resultLimited() && !pgQuery.setSingleRow && !pgQuery.preparing)) {
+                result = limitResult(pgQuery, result);
+                if (!result) {
+                    continue;
+                }
+            }
+            queryResult(pgQuery, result);
+        } else if (m_queuedQueries.size()) {
+            APGQuery &pgQuery = m_queuedQueries.head();
+            m_queryRunning = false;
+            if (Q_UNLIKELY(pgQuery.prepared && pgQuery.preparing)) {
+                if (Q_UNLIKELY(pgQuery.result->error())) {
+                    // PREPARE OR PREPARED QUERY ERROR
+                    auto query = m_queuedQueries.dequeue();
+                    nextQuery();
+                    query.done();
+                } else {
+                    // Query prepared
+                    m_preparedQueries.append(pgQuery.preparedName);
+                    pgQuery.result = std::make_shared<AResultPg>();
+                    pgQuery.preparing = false;
+                    nextQuery();
+                }
+            } else {
+                auto query = m_queuedQueries.dequeue();
+                if (Q_UNLIKELY(query.sessionSetup && query.result->error() && !m_queuedQueries.isEmpty())) {
+                    // Never run a query without its session parameters
+                    auto failed = m_queuedQueries.dequeue();
+                    failed.result = query.result;
+                    nextQuery();
+                    failed.done();
+                    break;
+                }
+                nextQuery();
+                query.done();
+            }
+            break;
+        } else {
+            break;
+        }
+    }
+}
+
+/*!
+ * Reads all available COPY data, returns false if it must wait
+ * for more data, or true once the COPY is done and the final
+ * result can be retrieved with PQgetResult().
+ */
+bool ADriverPg::readCopyData()
+{
+    APGQuery &pgQuery = m_queuedQueries.head();
+    char *buffer = nullptr;
+    int size;
+    while ((size = PQgetCopyData(m_conn, &buffer, 1)) > 0) {
+        if (pgQuery.copyDataCb && (!pgQuery.checkReceiver || !pgQuery.receiver.isNull())) {
+            pgQuery.copyDataCb(QByteArray::fromRawData(buffer, size));
+        }
+        PQfreemem(buffer);
+    }
+
+    if (size == 0) {
+        return false;
+    }
+
+    // -1 means the COPY is done and -2 an error, either way PQgetResult() has the status
+    m_copyOut = false;
+    return true;
+}
+
+/*!
+ * Sends COPY data until the producer is done or libpq can't
+ * queue more data, returns false if it must wait for the socket
+ * to be writable, or true once the end of the COPY was sent.
+ */
+bool ADriverPg::writeCopyData()
+{
+    APGQuery &pgQuery = m_queuedQueries.head();
+    for (;;) {
+        if (m_copyInData.isEmpty()) {
+            // Never commit partial data if the receiver is gone
+            const bool canceled = pgQuery.checkReceiver && pgQuery.receiver.isNull();
+            if (!m_copyInEnd && pgQuery.copyProducerCb && !canceled) {
+                m_copyInData = pgQuery.copyProducerCb();
+            }
+
+            if (m_copyInData.isEmpty()) {
+                // The producer is done, don't call it again if we have to retry
+                m_copyInEnd = true;
+                const int ret = PQputCopyEnd(m_conn, canceled ? "receiver destroyed" : nullptr);
+                if (ret == 0) {
+                    m_flush = true;
+                    m_writeNotify->setEnabled(true);
+                    return false;
+                }
+                // on error PQgetResult() has the status
+                m_copyIn = false;
+                m_copyInEnd = false;
+                cmdFlush();
+                return true;
+            }
+        }
+
+        const int ret = PQputCopyData(m_conn, m_copyInData.constData(), m_copyInData.size());
+        if (ret == 1) {
+            m_copyInData.clear();
+
+            // Don't let libpq buffer the whole COPY in memory, wait for the
+            // socket to drain before asking the producer for more data
+            const int flushed = PQflush(m_conn);
+            if (flushed == 1) {
+                m_flush = true;
+                m_writeNotify->setEnabled(true);
+                return false;
+            } else if (flushed == -1) {
+                qWarning(ASQL_PG) << "Failed to flush COPY data" << QString::fromLocal8Bit(PQerrorMessage(m_conn));
+                m_copyIn = false;
+                return true;
+            }
+        } else if (ret == 0) {
+            // libpq buffer is full, wait for the socket to be writable
+            m_flush = true;
+            m_writeNotify->setEnabled(true);
+            return false;
+        } else {
+            qWarning(ASQL_PG) << "Failed to send COPY data" << QString::fromLocal8Bit(PQerrorMessage(m_conn));
+            m_copyInData.clear();
+            m_copyIn = false;
+            return true;
+        }
+    }
+}
+
+void ADriverPg::releaseConnectionSlot()
+{
+    if (m_connectionSlot) {
+        m_connectionSlot = false;
+        connectionLimiter()->release();
+    }
+}
+
 void ADriverPg::setSingleRowMode()
 {
     if (PQsetSingleRowMode(m_conn) != 1) {
@@ -697,15 +1756,37 @@ void ADriverPg::setSingleRowMode()
     }
 }
 
+/*
+ * Single row mode when rows are streamed, a result limit only needs to
+ * count the rows so they are received in chunks when libpq supports it
+ */
+void ADriverPg::setRowsMode(const APGQuery &pgQuery)
+{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    if (!pgQuery.setSingleRow) {
+        if (PQsetChunkedRowsMode(m_conn, RESULT_LIMIT_CHUNK_ROWS) != 1) {
+            qWarning(ASQL_PG) << "Failed to set chunked rows mode";
+        }
+        return;
+    }
+#else
+    Q_UNUSED(pgQuery)
+#endif
+    setSingleRowMode();
+}
+
 void ADriverPg::cmdFlush()
 {
     int ret = PQflush(m_conn);
     if (Q_UNLIKELY(ret == -1)) {
         qWarning(ASQL_PG) << "Failed to flush" << QString::fromLocal8Bit(PQerrorMessage(m_conn));
     } else if (Q_UNLIKELY(ret == 1)) {
-        // Wait for write-ready and call it again
+        // Wait for write-ready or read-ready and call it again
         m_flush = true;
         m_writeNotify->setEnabled(true);
+    } else {
+        m_flush = false;
+        m_writeNotify->setEnabled(false);
     }
 }
 
@@ -713,6 +1794,9 @@ AResultPg::AResultPg() = default;
 
 AResultPg::~AResultPg()
 {
+    for (PGresult *rows : qAsConst(m_rows)) {
+        PQclear(rows);
+    }
     PQclear(m_result);
 }
 
@@ -733,7 +1817,31 @@ QString AResultPg::errorString() const
 
 int AResultPg::size() const
 {
-    return PQntuples(m_result);
+    return m_rows.isEmpty() ? PQntuples(m_result) : m_rowCount;
+}
+
+void AResultPg::setRows(const QVector<PGresult *> &rows)
+{
+    m_rows = rows;
+    m_rowOffsets.clear();
+    m_rowOffsets.reserve(rows.size());
+    m_rowCount = 0;
+    for (const PGresult *result : rows) {
+        m_rowOffsets.append(m_rowCount);
+        m_rowCount += PQntuples(result);
+    }
+}
+
+const PGresult *AResultPg::bufferedRow(int row, int &resultRow) const
+{
+    // All chunks but the last have the same number of rows
+    const int chunkRows = qMax(1, PQntuples(m_rows.constFirst()));
+    int index = qMin(row / chunkRows, m_rows.size() - 1);
+    if (m_rowOffsets[index] > row || (index + 1 < m_rows.size() && m_rowOffsets[index + 1] <= row)) {
+        index = int(std::upper_bound(m_rowOffsets.constBegin(), m_rowOffsets.constEnd(), row) - m_rowOffsets.constBegin()) - 1;
+    }
+    resultRow = row - m_rowOffsets[index];
+    return m_rows[index];
 }
 
 int AResultPg::fields() const
@@ -810,6 +1918,8 @@ static QMetaType::Type qDecodePSQLType(int t)
 
 QVariant AResultPg::value(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     if (column >= PQnfields(m_result)) {
         qWarning(ASQL_PG, "column %d out of range", column);
         return {};
@@ -817,9 +1927,9 @@ QVariant AResultPg::value(int row, int column) const
 
     int ptype = PQftype(m_result, column);
     QMetaType::Type type = qDecodePSQLType(ptype);
-    if (PQgetisnull(m_result, row, column))
+    if (PQgetisnull(res, resultRow, column))
         return QVariant(static_cast<QVariant::Type>(type));
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     switch (type) {
     case QMetaType::Bool:
         return QVariant((bool)(val[0] == 't'));
@@ -905,44 +2015,69 @@ QVariant AResultPg::value(int row, int column) const
     return {};
 }
 
+int AResultPg::columnType(int column) const
+{
+    const Oid type = PQftype(m_result, column);
+    switch (type) {
+    case QINT2OID:
+        return QMetaType::Short;
+    case QFLOAT4OID:
+        return QMetaType::Float;
+    default:
+        return qDecodePSQLType(int(type));
+    }
+}
+
 bool AResultPg::isNull(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "isNull", "column out of range");
-    return PQgetisnull(m_result, row, column) == 1;
+    return PQgetisnull(res, resultRow, column) == 1;
 }
 
 bool AResultPg::toBool(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toBool", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return val[0] == 't';
 }
 
 int AResultPg::toInt(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toInt", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return atoi(val);
 }
 
 qint64 AResultPg::toLongLong(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toLongLong", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return QString::fromLatin1(val).toLongLong();
 }
 
 quint64 AResultPg::toULongLong(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toULongLong", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return QString::fromLatin1(val).toULongLong();
 }
 
 double AResultPg::toDouble(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toDouble", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     if (qstricmp(val, "Infinity") == 0)
         return qInf();
     if (qstricmp(val, "-Infinity") == 0)
@@ -952,30 +2087,36 @@ double AResultPg::toDouble(int row, int column) const
 
 QString AResultPg::toString(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toString", "column out of range");
-    if (PQgetisnull(m_result, row, column) == 1) {
+    if (PQgetisnull(res, resultRow, column) == 1) {
         return {};
     }
 
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return QString::fromUtf8(val);
 }
 
 std::string AResultPg::toStdString(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toStdString", "column out of range");
-    if (PQgetisnull(m_result, row, column) == 1) {
+    if (PQgetisnull(res, resultRow, column) == 1) {
         return {};
     }
 
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     return std::string(val);
 }
 
 QDate AResultPg::toDate(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toDate", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     if (val[0] == '\0') {
         return {};
     } else {
@@ -989,8 +2130,10 @@ QDate AResultPg::toDate(int row, int column) const
 
 QTime AResultPg::toTime(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toTime", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     const QString str = QString::fromLatin1(val);
 #ifndef QT_NO_DATESTRING
     if (str.isEmpty())
@@ -1004,8 +2147,10 @@ QTime AResultPg::toTime(int row, int column) const
 
 QDateTime AResultPg::toDateTime(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toDateTime", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     QString dtval = QString::fromLatin1(val);
 #ifndef QT_NO_DATESTRING
     if (dtval.length() < 10) {
@@ -1022,13 +2167,15 @@ QDateTime AResultPg::toDateTime(int row, int column) const
 
 QJsonValue AResultPg::toJsonValue(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     QJsonValue ret;
     Q_ASSERT_X(column < PQnfields(m_result), "toJsonValue", "column out of range");
-    if (PQgetisnull(m_result, row, column) == 1) {
+    if (PQgetisnull(res, resultRow, column) == 1) {
         return ret;
     }
 
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     auto doc = QJsonDocument::fromJson(val);
     if (doc.isObject()) {
         ret = doc.object();
@@ -1040,8 +2187,10 @@ QJsonValue AResultPg::toJsonValue(int row, int column) const
 
 QByteArray AResultPg::toByteArray(int row, int column) const
 {
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
     Q_ASSERT_X(column < PQnfields(m_result), "toByteArray", "column out of range");
-    const char *val = PQgetvalue(m_result, row, column);
+    const char *val = PQgetvalue(res, resultRow, column);
     size_t len;
     unsigned char *data = PQunescapeBytea((const unsigned char*)val, &len);
     QByteArray ba(reinterpret_cast<const char *>(data), int(len));
@@ -1049,6 +2198,76 @@ QByteArray AResultPg::toByteArray(int row, int column) const
     return ba;
 }
 
+void AResultPg::toCbor(QCborStreamWriter &writer, int row, int column) const
+{
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
+    Q_ASSERT_X(column < PQnfields(m_result), "toCbor", "column out of range");
+    if (PQgetisnull(res, resultRow, column) == 1) {
+        writer.append(nullptr);
+        return;
+    }
+
+    const char *val = PQgetvalue(res, resultRow, column);
+    switch (PQftype(m_result, column)) {
+    case QBOOLOID:
+        writer.append(val[0] == 't');
+        break;
+    case QINT2OID:
+    case QINT4OID:
+    case QINT8OID:
+    case QOIDOID:
+    case QREGPROCOID:
+    case QXIDOID:
+    case QCIDOID:
+        writer.append(qint64(strtoll(val, nullptr, 10)));
+        break;
+    case QFLOAT4OID:
+    case QFLOAT8OID:
+        writer.append(toDouble(row, column));
+        break;
+    case QTIMESTAMPOID:
+    {
+        // Without a time zone there is no instant to tag, keep the wall clock time
+        const QDateTime dt = toDateTime(row, column);
+        if (dt.isValid()) {
+            writer.append(dt.toString(Qt::ISODateWithMs));
+        } else {
+            // infinity and friends
+            writer.appendTextString(val, qsizetype(PQgetlength(res, resultRow, column)));
+        }
+        break;
+    }
+    case QTIMESTAMPTZOID:
+    {
+        const QDateTime dt = toDateTime(row, column);
+        if (dt.isValid()) {
+            writer.append(QCborKnownTags::DateTimeString);
+            writer.append(dt.toUTC().toString(Qt::ISODateWithMs));
+        } else {
+            // infinity and friends
+            writer.appendTextString(val, qsizetype(PQgetlength(res, resultRow, column)));
+        }
+        break;
+    }
+    case QBYTEAOID:
+        writer.append(toByteArray(row, column));
+        break;
+    default:
+        // Text data is already UTF-8 encoded, no need to convert it to QString,
+        // this also keeps NUMERIC values with their full precision
+        writer.appendTextString(val, qsizetype(PQgetlength(res, resultRow, column)));
+    }
+}
+
+QByteArray AResultPg::rawValue(int row, int column) const
+{
+    int resultRow;
+    const PGresult *res = rowResult(row, resultRow);
+    // the text as received, valid while the result is alive
+    return QByteArray::fromRawData(PQgetvalue(res, resultRow, column), PQgetlength(res, resultRow, column));
+}
+
 void AResultPg::processResult()
 {
     if (!m_result) {
@@ -1068,6 +2287,9 @@ void AResultPg::processResult()
 //        canFetchMoreRows = false;
 //        return true;
     case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    case PGRES_TUPLES_CHUNK:
+#endif
 //        q->setSelect(true);
 //        q->setActive(true);
 //        currentSize = -1;
@@ -11,10 +11,13 @@
 
 #include "aresult.h"
 #include "apreparedquery.h"
+#include "astallmonitor.h"
 
 #include <QQueue>
 #include <QPointer>
 #include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
 
 namespace ASql {
 
@@ -49,11 +52,32 @@ public:
     QDateTime toDateTime(int row, int column) const override;
     QJsonValue toJsonValue(int row, int column) const final;
     QByteArray toByteArray(int row, int column) const override;
+    void toCbor(QCborStreamWriter &writer, int row, int column) const override;
+    int columnType(int column) const override;
+    QByteArray rawValue(int row, int column) const override;
 
     void processResult();
 
+    /*!
+     * Takes the rows buffered by a result limit, they are kept in the results
+     * they arrived in, m_result only has the columns and the command tag
+     */
+    void setRows(const QVector<PGresult *> &rows);
+
+    inline const PGresult *rowResult(int row, int &resultRow) const {
+        if (Q_LIKELY(m_rows.isEmpty())) {
+            resultRow = row;
+            return m_result;
+        }
+        return bufferedRow(row, resultRow);
+    }
+    const PGresult *bufferedRow(int row, int &resultRow) const;
+
     QString m_errorString;
     PGresult *m_result = nullptr;
+    QVector<PGresult *> m_rows;
+    QVector<int> m_rowOffsets;
+    int m_rowCount = 0;
     bool m_error = false;
     bool m_lastResultSet = true;
 };
@@ -64,20 +88,44 @@ public:
     APGQuery() : result(std::make_shared<AResultPg>())
     { }
     QByteArray query;
+    QByteArray sessionSetupQuery;
     APreparedQuery preparedQuery;
+    QByteArray preparedName;
     std::shared_ptr<AResultPg> result;
     QVariantList params;
     AResultFn cb;
+    ACopyDataFn copyDataCb;
+    ACopyProducerFn copyProducerCb;
+    QHash<QString, QString> sessionParameters;
     QPointer<QObject> receiver;
     QObject *checkReceiver;
+    qint64 maxResultSize = 0;
+    qint64 maxResultRows = 0;
+    int sessionSetupResults = 0;
+    ADatabase::ResultLimitAction resultLimitAction = ADatabase::ResultLimitAction::Abort;
     bool preparing = false;
     bool prepared = false;
     bool setSingleRow = false;
+    bool resultLimitExceeded = false;
+    bool sessionSetup = false;
+
+    inline bool resultLimited() const {
+        return maxResultSize || maxResultRows;
+    }
 
     inline void done() {
         AResult r(result);
         if (cb && (!checkReceiver || !receiver.isNull())) {
-            cb(r);
+            if (Q_UNLIKELY(AStallMonitor::isEnabled())) {
+                // the receiver might get deleted by the callback
+                const QString tag = AStallMonitor::receiverTag(receiver.data());
+                QElapsedTimer timer;
+                timer.start();
+                cb(r);
+                AStallMonitor::record(prepared ? preparedQuery.query() : query, tag, timer.nsecsElapsed());
+            } else {
+                cb(r);
+            }
         }
     }
 };
@@ -105,21 +153,48 @@ public:
     void exec(const std::shared_ptr<ADriver> &db, QStringView query, const QVariantList &params, AResultFn cb, QObject *receiver) override;
     void exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &query, const QVariantList &params, AResultFn cb, QObject *receiver) override;
 
+    void copyTo(const std::shared_ptr<ADriver> &db, const QString &query, ACopyDataFn dataCb, AResultFn cb, QObject *receiver) override;
+
+    void copyFrom(const std::shared_ptr<ADriver> &db, const QString &query, ACopyProducerFn producer, AResultFn cb, QObject *receiver) override;
+
     void setLastQuerySingleRowMode() override;
 
+    void setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows) override;
+    void setLastQueryResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, qint64 maxRows) override;
+
+    void setSessionParameters(const QHash<QString, QString> &parameters) override;
+    void setSessionParameter(const QString &name, const QString &value) override;
+    QHash<QString, QString> sessionParameters() const override;
+
     void subscribeToNotification(const std::shared_ptr<ADriver> &db, const QString &name, ANotificationFn cb, QObject *receiver) override;
     QStringList subscribedToNotifications() const override;
     void unsubscribeFromNotification(const std::shared_ptr<ADriver> &db, const QString &name) override;
 
 private:
+    void openConnection(std::function<void(bool isOpen, const QString &error)> cb);
+    void startResolvedConnection(const QByteArrayList &keywords, const QByteArrayList &values, const QVector<QByteArrayList> &resolved, std::function<void(bool isOpen, const QString &error)> cb);
+    void startConnection(const QByteArrayList &keywords, const QByteArrayList &values, std::function<void(bool isOpen, const QString &error)> cb);
     inline void queryConstructed(APGQuery &pgQuery);
     void nextQuery();
+    void startQuery(APGQuery &pgQuery);
+    QByteArray sessionSetup(const QHash<QString, QString> &parameters, int &commands);
+    void trackSessionState(PGresult *result);
+    void invalidateSessionState();
     void finishConnection();
     void finishQueries(const QString &error);
     inline void doExec(APGQuery &pgQuery);
     inline void doExecParams(APGQuery &query);
     inline void setSingleRowMode();
+    void setRowsMode(const APGQuery &pgQuery);
     inline void cmdFlush();
+    inline void releaseConnectionSlot();
+    void cancelRunningQuery();
+    void queryResult(APGQuery &pgQuery, PGresult *result);
+    PGresult *limitResult(APGQuery &pgQuery, PGresult *result);
+    void clearLimitedRows();
+    void readResults();
+    bool readCopyData();
+    bool writeCopyData();
 
     PGconn *m_conn = nullptr;
     ADatabase::State m_state = ADatabase::State::Disconnected;
@@ -127,13 +202,27 @@ private:
     bool m_flush = false;
     bool m_queryRunning = false;
     bool m_notificationPtrSet = false;
+    bool m_connectionSlot = false;
+    bool m_copyOut = false;
+    bool m_copyIn = false;
+    bool m_copyInEnd = false;
     std::function<void (ADatabase::State, const QString &)> m_stateChangedCb;
     QHash<QString, ANotificationFn> m_subscribedNotifications;
+    QHash<QString, QString> m_sessionParameters;
+    QHash<QString, QString> m_sessionCurrent;
+    QSet<QString> m_sessionUnknown;
     QQueue<APGQuery> m_queuedQueries;
     std::shared_ptr<ADriver> selfDriver;
     QSocketNotifier *m_writeNotify = nullptr;
     QSocketNotifier *m_readNotify = nullptr;
     QByteArrayList m_preparedQueries;
+    QByteArray m_copyInData;
+    QVector<PGresult *> m_limitedRows;
+    qint64 m_limitedRowsSize = 0;
+    qint64 m_limitedRowsCount = 0;
+    qint64 m_maxResultSize = 0;
+    qint64 m_maxResultRows = 0;
+    ADatabase::ResultLimitAction m_resultLimitAction = ADatabase::ResultLimitAction::Abort;
 };
 
 }
@@ -0,0 +1,412 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "adriversqlite.h"
+
+#include "apreparedquery.h"
+#include "aresultvalues.h"
+
+#include <sqlite3.h>
+
+#include <QDateTime>
+#include <QThread>
+#include <QUrl>
+#include <QUuid>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(ASQL_SQLITE, "asql.sqlite", QtInfoMsg)
+
+using namespace ASql;
+
+namespace {
+
+bool onlyWhiteSpace(const char *begin, const char *end)
+{
+    for (; begin < end; ++begin) {
+        if (!QChar::isSpace(uchar(*begin)) && *begin != ';') {
+            return false;
+        }
+    }
+    return true;
+}
+
+int bindValue(sqlite3_stmt *stmt, int pos, const QVariant &value)
+{
+    if (value.isNull()) {
+        return sqlite3_bind_null(stmt, pos);
+    }
+
+    switch (value.userType()) {
+    case QMetaType::Bool:
+    case QMetaType::Char:
+    case QMetaType::UChar:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        return sqlite3_bind_int64(stmt, pos, value.toLongLong());
+    case QMetaType::Float:
+    case QMetaType::Double:
+        return sqlite3_bind_double(stmt, pos, value.toDouble());
+    case QMetaType::QByteArray:
+    {
+        const QByteArray data = value.toByteArray();
+        return sqlite3_bind_blob64(stmt, pos, data.constData(), sqlite3_uint64(data.size()), SQLITE_TRANSIENT);
+    }
+    case QMetaType::QDateTime:
+        return sqlite3_bind_text(stmt, pos, value.toDateTime().toString(Qt::ISODateWithMs).toUtf8().constData(), -1, SQLITE_TRANSIENT);
+    case QMetaType::QTime:
+        return sqlite3_bind_text(stmt, pos, value.toTime().toString(Qt::ISODateWithMs).toUtf8().constData(), -1, SQLITE_TRANSIENT);
+    case QMetaType::QUuid:
+        return sqlite3_bind_text(stmt, pos, value.toUuid().toString(QUuid::WithoutBraces).toUtf8().constData(), -1, SQLITE_TRANSIENT);
+    default:
+    {
+        const QByteArray text = value.toString().toUtf8();
+        return sqlite3_bind_text64(stmt, pos, text.constData(), sqlite3_uint64(text.size()), SQLITE_TRANSIENT, SQLITE_UTF8);
+    }
+    }
+}
+
+QVariant columnValue(sqlite3_stmt *stmt, int column)
+{
+    switch (sqlite3_column_type(stmt, column)) {
+    case SQLITE_INTEGER:
+        return qint64(sqlite3_column_int64(stmt, column));
+    case SQLITE_FLOAT:
+        return sqlite3_column_double(stmt, column);
+    case SQLITE_TEXT:
+        return QString::fromUtf8(reinterpret_cast<const char *>(sqlite3_column_text(stmt, column)),
+                                 sqlite3_column_bytes(stmt, column));
+    case SQLITE_BLOB:
+        return QByteArray(reinterpret_cast<const char *>(sqlite3_column_blob(stmt, column)),
+                          sqlite3_column_bytes(stmt, column));
+    default:
+        return {};
+    }
+}
+
+}
+
+ASqliteStatement::~ASqliteStatement()
+{
+    sqlite3_finalize(stmt);
+}
+
+ASqliteWorker::ASqliteWorker(int statementCacheSize)
+{
+    m_statements.setMaxCost(statementCacheSize);
+}
+
+ASqliteWorker::~ASqliteWorker()
+{
+    // statements must be finalized before the connection is closed
+    m_statements.clear();
+    if (m_db) {
+        sqlite3_close_v2(m_db);
+    }
+}
+
+QString ASqliteWorker::open(const QString &connectionInfo)
+{
+    if (m_db) {
+        return {};
+    }
+
+    QString file = connectionInfo;
+    if (file.startsWith(QLatin1String("sqlite:"))) {
+        file = QUrl(connectionInfo).path();
+    }
+
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX;
+    const int rc = sqlite3_open_v2(file.toUtf8().constData(), &m_db, flags, nullptr);
+    if (rc != SQLITE_OK) {
+        const QString error = m_db ? QString::fromUtf8(sqlite3_errmsg(m_db)) : QString::fromUtf8(sqlite3_errstr(rc));
+        sqlite3_close_v2(m_db);
+        m_db = nullptr;
+        return error;
+    }
+
+    // Wait for other connections holding the write lock instead of failing right away
+    sqlite3_busy_timeout(m_db, 5000);
+    return {};
+}
+
+std::vector<std::shared_ptr<AResultValues>> ASqliteWorker::exec(const QByteArray &query, const QVariantList &params)
+{
+    if (!m_db) {
+        return {errorResult(QStringLiteral("Database is not open"))};
+    }
+
+    ASqliteStatement *cached = m_statements.object(query);
+    if (cached) {
+        return {step(cached->stmt, params, true)};
+    }
+
+    std::vector<std::shared_ptr<AResultValues>> results;
+    const char *tail = query.constData();
+    const char *end = tail + query.size();
+    while (tail < end) {
+        sqlite3_stmt *stmt = nullptr;
+        const char *next = nullptr;
+        if (sqlite3_prepare_v2(m_db, tail, int(end - tail), &stmt, &next) != SQLITE_OK) {
+            results.push_back(errorResult(QString::fromUtf8(sqlite3_errmsg(m_db))));
+            break;
+        }
+
+        if (!stmt) {
+            // only white space or comments were left
+            break;
+        }
+
+        const bool last = onlyWhiteSpace(next, end);
+        auto result = step(stmt, params, last);
+        results.push_back(result);
+
+        // Only queries with a single statement can be looked up by their text
+        if (last && results.size() == 1 && m_statements.maxCost() > 0) {
+            m_statements.insert(query, new ASqliteStatement(stmt));
+        } else {
+            sqlite3_finalize(stmt);
+        }
+
+        if (result->error()) {
+            break;
+        }
+        tail = next;
+    }
+
+    if (results.empty()) {
+        results.push_back(std::make_shared<AResultValues>(QStringList()));
+    }
+    return results;
+}
+
+std::shared_ptr<AResultValues> ASqliteWorker::step(sqlite3_stmt *stmt, const QVariantList &params, bool lastResultSet)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    const int count = sqlite3_bind_parameter_count(stmt);
+    int sequential = 0;
+    for (int i = 1; i <= count; ++i) {
+        // $1 and ?1 are bound by their number like in PostgreSQL, plain ? in order
+        const char *name = sqlite3_bind_parameter_name(stmt, i);
+        int pos = sequential++;
+        if (name) {
+            bool ok;
+            pos = QByteArray(name + 1).toInt(&ok) - 1;
+            if (!ok) {
+                return errorResult(QLatin1String("Named parameters are not supported: ") + QString::fromUtf8(name));
+            }
+        }
+
+        if (pos < 0 || pos >= params.size()) {
+            return errorResult(QStringLiteral("Missing value for parameter %1").arg(i));
+        }
+
+        if (bindValue(stmt, i, params.at(pos)) != SQLITE_OK) {
+            const QString error = QString::fromUtf8(sqlite3_errmsg(m_db));
+            sqlite3_clear_bindings(stmt);
+            return errorResult(error);
+        }
+    }
+
+    const int columns = sqlite3_column_count(stmt);
+    QStringList fieldNames;
+    fieldNames.reserve(columns);
+    for (int i = 0; i < columns; ++i) {
+        fieldNames.append(QString::fromUtf8(sqlite3_column_name(stmt, i)));
+    }
+
+    auto result = std::make_shared<AResultValues>(fieldNames);
+    result->setLastResultSet(lastResultSet);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        QVariantList row;
+        row.reserve(columns);
+        for (int i = 0; i < columns; ++i) {
+            row.append(columnValue(stmt, i));
+        }
+        result->appendRow(row);
+    }
+
+    if (rc != SQLITE_DONE) {
+        result->setError(QString::fromUtf8(sqlite3_errmsg(m_db)));
+        result->setLastResultSet(true);
+    } else if (columns == 0) {
+        result->setNumRowsAffected(sqlite3_changes(m_db));
+    }
+
+    // Releases the read lock and the bound values of cached statements
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    return result;
+}
+
+std::shared_ptr<AResultValues> ASqliteWorker::errorResult(const QString &error) const
+{
+    qCDebug(ASQL_SQLITE) << "Query failed" << error;
+    auto ret = std::make_shared<AResultValues>(QStringList());
+    ret->setError(error);
+    return ret;
+}
+
+ADriverSqlite::ADriverSqlite(const QString &connInfo, int statementCacheSize) : ADriver(connInfo)
+  , m_thread(new QThread(this))
+  , m_worker(new ASqliteWorker(statementCacheSize))
+{
+    m_thread->setObjectName(QStringLiteral("asql-sqlite"));
+    m_worker->moveToThread(m_thread);
+    m_thread->start();
+}
+
+ADriverSqlite::~ADriverSqlite()
+{
+    // queries not started yet are dropped along with their callbacks
+    m_thread->quit();
+    m_thread->wait();
+    delete m_worker;
+}
+
+bool ADriverSqlite::isValid() const
+{
+    return true;
+}
+
+void ADriverSqlite::open(std::function<void(bool, const QString &)> cb)
+{
+    qDebug(ASQL_SQLITE) << "Open" << connectionInfo();
+
+    if (m_state == ADatabase::State::Connected) {
+        if (cb) {
+            cb(true, {});
+        }
+        return;
+    }
+
+    m_state = ADatabase::State::Connecting;
+    auto worker = m_worker;
+    const QString info = connectionInfo();
+    // The worker thread is joined before the driver is deleted, so "this" outlives the task
+    QMetaObject::invokeMethod(m_worker, [this, worker, info, cb] {
+        const QString error = worker->open(info);
+        QMetaObject::invokeMethod(this, [this, error, cb] {
+            if (error.isEmpty()) {
+                setState(ADatabase::State::Connected, {});
+            } else {
+                qWarning(ASQL_SQLITE) << "Failed to open" << connectionInfo() << error;
+                setState(ADatabase::State::Disconnected, error);
+            }
+
+            if (cb) {
+                cb(error.isEmpty(), error);
+            }
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+bool ADriverSqlite::isOpen() const
+{
+    return m_state == ADatabase::State::Connected;
+}
+
+void ADriverSqlite::setState(ADatabase::State state, const QString &status)
+{
+    m_state = state;
+    if (m_stateChangedCb) {
+        m_stateChangedCb(state, status);
+    }
+}
+
+ADatabase::State ADriverSqlite::state() const
+{
+    return m_state;
+}
+
+void ADriverSqlite::onStateChanged(std::function<void(ADatabase::State, const QString &)> cb)
+{
+    m_stateChangedCb = cb;
+}
+
+void ADriverSqlite::begin(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, QByteArrayLiteral("BEGIN"), {}, cb, receiver);
+}
+
+void ADriverSqlite::commit(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, QByteArrayLiteral("COMMIT"), {}, cb, receiver);
+}
+
+void ADriverSqlite::rollback(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, QByteArrayLiteral("ROLLBACK"), {}, cb, receiver);
+}
+
+void ADriverSqlite::exec(const std::shared_ptr<ADriver> &db, const QString &query, const QVariantList &params, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, query.toUtf8(), params, cb, receiver);
+}
+
+void ADriverSqlite::exec(const std::shared_ptr<ADriver> &db, QStringView query, const QVariantList &params, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, query.toUtf8(), params, cb, receiver);
+}
+
+void ADriverSqlite::exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &query, const QVariantList &params, AResultFn cb, QObject *receiver)
+{
+    queueQuery(db, query.query(), params, cb, receiver);
+}
+
+void ADriverSqlite::queueQuery(const std::shared_ptr<ADriver> &db, const QByteArray &query, const QVariantList &params, AResultFn cb, QObject *receiver)
+{
+    ASqliteQuery sqliteQuery;
+    sqliteQuery.cb = cb;
+    sqliteQuery.receiver = receiver;
+    sqliteQuery.checkReceiver = receiver;
+    m_queue.enqueue(sqliteQuery);
+    selfDriver = db;
+
+    // Callbacks stay on this thread, the worker only gets the query data and
+    // runs the tasks in order so results arrive in the same order as the queue
+    auto worker = m_worker;
+    QMetaObject::invokeMethod(m_worker, [this, worker, query, params] {
+        const auto results = worker->exec(query, params);
+        QMetaObject::invokeMethod(this, [this, results] {
+            deliverResults(results);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void ADriverSqlite::deliverResults(const std::vector<std::shared_ptr<AResultValues>> &results)
+{
+    if (m_queue.isEmpty()) {
+        qCritical(ASQL_SQLITE) << "Got results without a pending query";
+        return;
+    }
+
+    ASqliteQuery query = m_queue.dequeue();
+    if (query.cb) {
+        for (const auto &values : results) {
+            if (query.checkReceiver && query.receiver.isNull()) {
+                break;
+            }
+            AResult result(values);
+            query.cb(result);
+        }
+    }
+
+    if (m_queue.isEmpty()) {
+        // might delete this
+        selfDriver = {};
+    }
+}
+
+#include "moc_adriversqlite.cpp"
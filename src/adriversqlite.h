@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ADRIVERSQLITE_H
+#define ADRIVERSQLITE_H
+
+#include <adriver.h>
+
+#include "aresult.h"
+
+#include <QCache>
+#include <QPointer>
+#include <QQueue>
+
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+class QThread;
+
+namespace ASql {
+
+class AResultValues;
+
+class ASqliteStatement
+{
+public:
+    explicit ASqliteStatement(sqlite3_stmt *stmt) : stmt(stmt) { }
+    ~ASqliteStatement();
+
+    sqlite3_stmt *stmt;
+};
+
+/*!
+ * \internal
+ * Owns the sqlite3 handle, lives and runs on the driver's worker thread
+ */
+class ASqliteWorker : public QObject
+{
+public:
+    explicit ASqliteWorker(int statementCacheSize);
+    ~ASqliteWorker();
+
+    QString open(const QString &connectionInfo);
+    std::vector<std::shared_ptr<AResultValues>> exec(const QByteArray &query, const QVariantList &params);
+
+private:
+    std::shared_ptr<AResultValues> step(sqlite3_stmt *stmt, const QVariantList &params, bool lastResultSet);
+    std::shared_ptr<AResultValues> errorResult(const QString &error) const;
+
+    sqlite3 *m_db = nullptr;
+    QCache<QByteArray, ASqliteStatement> m_statements;
+};
+
+class ASqliteQuery
+{
+public:
+    AResultFn cb;
+    QPointer<QObject> receiver;
+    QObject *checkReceiver;
+};
+
+class ADriverSqlite final : public ADriver
+{
+    Q_OBJECT
+public:
+    ADriverSqlite(const QString &connInfo, int statementCacheSize);
+    virtual ~ADriverSqlite();
+
+    bool isValid() const override;
+    void open(std::function<void(bool isOpen, const QString &error)> cb) override;
+    bool isOpen() const override;
+
+    void setState(ADatabase::State state, const QString &status);
+    ADatabase::State state() const override;
+    void onStateChanged(std::function<void(ADatabase::State state, const QString &status)> cb) override;
+
+    void begin(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver) override;
+    void commit(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver) override;
+    void rollback(const std::shared_ptr<ADriver> &db, AResultFn cb, QObject *receiver) override;
+
+    void exec(const std::shared_ptr<ADriver> &db, const QString &query, const QVariantList &params, AResultFn cb, QObject *receiver) override;
+    void exec(const std::shared_ptr<ADriver> &db, QStringView query, const QVariantList &params, AResultFn cb, QObject *receiver) override;
+    void exec(const std::shared_ptr<ADriver> &db, const APreparedQuery &query, const QVariantList &params, AResultFn cb, QObject *receiver) override;
+
+private:
+    void queueQuery(const std::shared_ptr<ADriver> &db, const QByteArray &query, const QVariantList &params, AResultFn cb, QObject *receiver);
+    void deliverResults(const std::vector<std::shared_ptr<AResultValues>> &results);
+
+    QThread *m_thread;
+    ASqliteWorker *m_worker;
+    QQueue<ASqliteQuery> m_queue;
+    std::shared_ptr<ADriver> selfDriver;
+    std::function<void(ADatabase::State state, const QString &status)> m_stateChangedCb;
+    ADatabase::State m_state = ADatabase::State::Disconnected;
+};
+
+}
+
+#endif // ADRIVERSQLITE_H
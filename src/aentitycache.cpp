@@ -0,0 +1,246 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aentitycache.h"
+
+#include "apool.h"
+#include "aresult.h"
+#include "aresultvalues.h"
+
+#include <QDateTime>
+#include <QPointer>
+#include <QUuid>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(ASQL_ENTITY_CACHE, "asql.entitycache", QtWarningMsg)
+
+namespace ASql {
+
+struct AEntityRow {
+    QVariantList values;
+    qint64 fetchedTs = 0;
+};
+
+struct AEntityRequest {
+    QVariantList keys;
+    AResultFn cb;
+    QPointer<QObject> receiver;
+    QObject *checkReceiver = nullptr;
+    QString errorString;
+    int pending = 0;
+    bool error = false;
+};
+
+class AEntityCachePrivate
+{
+public:
+    bool isFresh(const AEntityRow &row) const;
+    void deliver(const std::shared_ptr<AEntityRequest> &request);
+    void fetched(const QVariantList &keys, AResult &result);
+
+    QString query;
+    QString keyColumn;
+    QString poolName;
+    ADatabase db;
+    QStringList fieldNames;
+    QHash<QString, AEntityRow> rows;
+    QHash<QString, std::vector<std::shared_ptr<AEntityRequest>>> inFlight;
+    qint64 maxAgeMs = -1;
+    int keyIndex = -1;
+    bool usePool = false;
+};
+
+}
+
+using namespace ASql;
+
+/*
+ * Keys are compared by their text so the QVariant type given by
+ * the caller doesn't need to match the one returned by the driver
+ */
+static QString keyString(const QVariant &key)
+{
+    if (key.userType() == QMetaType::QUuid) {
+        return key.toUuid().toString(QUuid::WithoutBraces);
+    }
+    return key.toString();
+}
+
+bool AEntityCachePrivate::isFresh(const AEntityRow &row) const
+{
+    return maxAgeMs == -1 || row.fetchedTs >= QDateTime::currentMSecsSinceEpoch() - maxAgeMs;
+}
+
+void AEntityCachePrivate::deliver(const std::shared_ptr<AEntityRequest> &request)
+{
+    if (!request->cb || (request->checkReceiver && request->receiver.isNull())) {
+        return;
+    }
+
+    auto values = std::make_shared<AResultValues>(fieldNames);
+    if (request->error) {
+        values->setError(request->errorString);
+    } else {
+        for (const QVariant &key : qAsConst(request->keys)) {
+            auto it = rows.constFind(keyString(key));
+            if (it != rows.constEnd()) {
+                values->appendRow(it.value().values);
+            }
+        }
+    }
+
+    AResult result(values);
+    request->cb(result);
+}
+
+void AEntityCachePrivate::fetched(const QVariantList &keys, AResult &result)
+{
+    if (!result.error()) {
+        if (fieldNames.isEmpty() || keyIndex == -1) {
+            fieldNames = result.columnNames();
+            keyIndex = fieldNames.indexOf(keyColumn);
+            if (keyIndex == -1) {
+                qCCritical(ASQL_ENTITY_CACHE) << "Key column not found in the result" << keyColumn << fieldNames;
+            }
+        }
+
+        // Rows that were deleted since they were cached must not be served anymore
+        for (const QVariant &key : keys) {
+            rows.remove(keyString(key));
+        }
+
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for (auto row : result) {
+            AEntityRow entity;
+            entity.values = row.toList();
+            entity.fetchedTs = now;
+            if (keyIndex != -1) {
+                rows.insert(keyString(entity.values.value(keyIndex)), entity);
+            }
+        }
+        qCDebug(ASQL_ENTITY_CACHE) << "fetched" << result.size() << "of" << keys.size() << "keys";
+    } else {
+        qCWarning(ASQL_ENTITY_CACHE) << "Failed to fetch keys" << result.errorString();
+    }
+
+    std::vector<std::shared_ptr<AEntityRequest>> ready;
+    for (const QVariant &key : keys) {
+        const auto waiting = inFlight.take(keyString(key));
+        for (const auto &request : waiting) {
+            if (result.error() && !request->error) {
+                request->error = true;
+                request->errorString = result.errorString();
+            }
+
+            if (--request->pending == 0) {
+                ready.push_back(request);
+            }
+        }
+    }
+
+    for (const auto &request : ready) {
+        deliver(request);
+    }
+}
+
+AEntityCache::AEntityCache(const QString &query, const QString &keyColumn, QObject *parent) : QObject(parent)
+  , d_ptr(new AEntityCachePrivate)
+{
+    Q_D(AEntityCache);
+    d->query = query;
+    d->keyColumn = keyColumn;
+}
+
+AEntityCache::~AEntityCache()
+{
+    delete d_ptr;
+}
+
+void AEntityCache::setDatabasePool(const QString &poolName)
+{
+    Q_D(AEntityCache);
+    d->poolName = poolName;
+    d->db = ADatabase();
+    d->usePool = true;
+}
+
+void AEntityCache::setDatabase(const ADatabase &db)
+{
+    Q_D(AEntityCache);
+    d->poolName.clear();
+    d->db = db;
+    d->usePool = false;
+}
+
+void AEntityCache::setMaxAge(qint64 maxAgeMs)
+{
+    Q_D(AEntityCache);
+    d->maxAgeMs = maxAgeMs;
+}
+
+void AEntityCache::get(const QVariantList &keys, AResultFn cb, QObject *receiver)
+{
+    Q_D(AEntityCache);
+    auto request = std::make_shared<AEntityRequest>();
+    request->keys = keys;
+    request->cb = cb;
+    request->receiver = receiver;
+    request->checkReceiver = receiver;
+
+    QVariantList missing;
+    for (const QVariant &key : keys) {
+        const QString id = keyString(key);
+        auto it = d->rows.constFind(id);
+        if (it != d->rows.constEnd() && d->isFresh(it.value())) {
+            continue;
+        }
+
+        auto inFlightIt = d->inFlight.find(id);
+        if (inFlightIt == d->inFlight.end()) {
+            missing.append(key);
+            inFlightIt = d->inFlight.insert(id, {});
+        }
+        inFlightIt.value().push_back(request);
+        ++request->pending;
+    }
+
+    if (missing.isEmpty()) {
+        if (request->pending == 0) {
+            d->deliver(request);
+        }
+        return;
+    }
+
+    ADatabase db = d->usePool ? APool::database(d->poolName) : d->db;
+    if (!db.isValid()) {
+        qCCritical(ASQL_ENTITY_CACHE) << "Database was not set or is not valid" << d->poolName;
+    }
+
+    qCDebug(ASQL_ENTITY_CACHE) << "fetching" << missing.size() << "of" << keys.size() << "keys";
+    db.exec(d->query, {QVariant(missing)}, [this, missing] (AResult &result) {
+        Q_D(AEntityCache);
+        d->fetched(missing, result);
+    }, this);
+}
+
+bool AEntityCache::clear(const QVariant &key)
+{
+    Q_D(AEntityCache);
+    return d->rows.remove(keyString(key));
+}
+
+void AEntityCache::clearAll()
+{
+    Q_D(AEntityCache);
+    d->rows.clear();
+}
+
+int AEntityCache::size() const
+{
+    Q_D(const AEntityCache);
+    return d->rows.size();
+}
+
+#include "moc_aentitycache.cpp"
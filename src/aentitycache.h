@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef AENTITYCACHE_H
+#define AENTITYCACHE_H
+
+#include <QObject>
+
+#include <adatabase.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+class AEntityCachePrivate;
+
+/*!
+ * \brief The AEntityCache class caches rows by their primary key
+ *
+ * Unlike ACache which caches the result of whole queries, rows are cached individually,
+ * get() returns the cached rows and fetches only the missing keys with a single query,
+ * so requests for overlapping but different sets of keys still hit the cache.
+ *
+ * The query must select the rows whose key is in the array bound to $1:
+ * \code{.cpp}
+ * auto cache = new AEntityCache(QStringLiteral("SELECT * FROM users WHERE id = ANY($1)"), QStringLiteral("id"), this);
+ * cache->setDatabasePool(QStringLiteral("pool"));
+ * cache->get({1, 2, 3}, [] (AResult &result) {
+ *     // rows in the order of the requested keys, keys not found are skipped
+ * });
+ * \endcode
+ */
+class ASQL_EXPORT AEntityCache : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(AEntityCache)
+public:
+    /*!
+     * \brief AEntityCache constructs a new entity cache
+     * \param query selects rows by key using "= ANY($1)"
+     * \param keyColumn name of the key column in the query result
+     * \param parent
+     */
+    explicit AEntityCache(const QString &query, const QString &keyColumn, QObject *parent = nullptr);
+    virtual ~AEntityCache();
+
+    void setDatabasePool(const QString &poolName);
+    void setDatabase(const ADatabase &db);
+
+    /*!
+     * \brief setMaxAge rows older than \p maxAgeMs are fetched again, the default -1 never expires them
+     * \param maxAgeMs
+     */
+    void setMaxAge(qint64 maxAgeMs);
+
+    /*!
+     * \brief get retrieves the rows of \p keys, fetching the ones not cached with a single query
+     *
+     * Keys already being fetched by a previous call are not requested again. The callback
+     * receives the rows in the order of \p keys, keys that do not exist are skipped.
+     *
+     * Missing keys are not cached, asking for them again always queries the database.
+     *
+     * \param keys
+     * \param cb
+     * \param receiver
+     */
+    void get(const QVariantList &keys, AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief clear removes the row of \p key from the cache
+     * \return true if it was cached
+     */
+    bool clear(const QVariant &key);
+
+    /*!
+     * \brief clearAll removes all rows from the cache
+     */
+    void clearAll();
+
+    /*!
+     * \brief size returns the number of cached rows
+     */
+    int size() const;
+
+private:
+    AEntityCachePrivate *d_ptr;
+};
+
+}
+
+#endif // AENTITYCACHE_H
@@ -0,0 +1,241 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "alargeobject.h"
+
+#include "aresultvalues.h"
+
+#include <QIODevice>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(ASQL_LO, "asql.largeobject", QtInfoMsg)
+
+using namespace ASql;
+
+namespace ASql {
+
+class ALargeObjectPrivate
+{
+public:
+    ADatabase db;
+    quint32 oid = 0;
+    int fd = -1;
+};
+
+}
+
+namespace {
+
+// Number of chunk queries queued at once while streaming
+const int transferWindow = 2;
+
+struct ATransfer {
+    std::shared_ptr<ALargeObjectPrivate> d;
+    QIODevice *device;
+    AResultFn cb;
+    QObject *receiver;
+    int chunkSize;
+    int inFlight = 0;
+    bool done = false;
+};
+
+void finishTransfer(const std::shared_ptr<ATransfer> &transfer, AResult &result)
+{
+    transfer->done = true;
+    if (transfer->cb) {
+        transfer->cb(result);
+    }
+}
+
+void failTransfer(const std::shared_ptr<ATransfer> &transfer, const QString &error)
+{
+    qCWarning(ASQL_LO) << "Large object transfer failed" << transfer->d->oid << error;
+    auto failed = std::make_shared<AResultValues>(QStringList());
+    failed->setError(error);
+    AResult result(failed);
+    finishTransfer(transfer, result);
+}
+
+void readChunk(const std::shared_ptr<ATransfer> &transfer)
+{
+    ++transfer->inFlight;
+    transfer->d->db.exec(QStringLiteral("SELECT loread($1, $2)"), {transfer->d->fd, transfer->chunkSize},
+                         [transfer] (AResult &result) {
+        --transfer->inFlight;
+        if (transfer->done) {
+            // a read queued past the end of the object
+            return;
+        }
+
+        if (result.error()) {
+            finishTransfer(transfer, result);
+            return;
+        }
+
+        const QByteArray data = result.size() ? result.begin()[0].toByteArray() : QByteArray();
+        if (!data.isEmpty() && transfer->device->write(data) != data.size()) {
+            failTransfer(transfer, transfer->device->errorString());
+            return;
+        }
+
+        if (data.size() < transfer->chunkSize) {
+            finishTransfer(transfer, result);
+        } else {
+            readChunk(transfer);
+        }
+    }, transfer->receiver);
+}
+
+void writeChunk(const std::shared_ptr<ATransfer> &transfer)
+{
+    const QByteArray data = transfer->device->read(transfer->chunkSize);
+    if (data.isEmpty()) {
+        if (transfer->inFlight == 0) {
+            auto empty = std::make_shared<AResultValues>(QStringList());
+            AResult result(empty);
+            finishTransfer(transfer, result);
+        }
+        return;
+    }
+
+    ++transfer->inFlight;
+    transfer->d->db.exec(QStringLiteral("SELECT lowrite($1, $2)"), {transfer->d->fd, data},
+                         [transfer] (AResult &result) {
+        --transfer->inFlight;
+        if (transfer->done) {
+            return;
+        }
+
+        if (result.error()) {
+            finishTransfer(transfer, result);
+            return;
+        }
+
+        if (transfer->device->atEnd()) {
+            if (transfer->inFlight == 0) {
+                finishTransfer(transfer, result);
+            }
+        } else {
+            writeChunk(transfer);
+        }
+    }, transfer->receiver);
+}
+
+}
+
+ALargeObject::ALargeObject(const ADatabase &db)
+    : d(std::make_shared<ALargeObjectPrivate>())
+{
+    d->db = db;
+}
+
+ALargeObject::ALargeObject(const ADatabase &db, quint32 oid)
+    : d(std::make_shared<ALargeObjectPrivate>())
+{
+    d->db = db;
+    d->oid = oid;
+}
+
+quint32 ALargeObject::oid() const
+{
+    return d->oid;
+}
+
+bool ALargeObject::isOpen() const
+{
+    return d->fd >= 0;
+}
+
+void ALargeObject::create(AResultFn cb, QObject *receiver)
+{
+    auto priv = d;
+    d->db.exec(QStringLiteral("SELECT lo_create(0)"), [priv, cb] (AResult &result) {
+        if (!result.error() && result.size()) {
+            priv->oid = quint32(result.begin()[0].toLongLong());
+        }
+        if (cb) {
+            cb(result);
+        }
+    }, receiver);
+}
+
+void ALargeObject::open(OpenMode mode, AResultFn cb, QObject *receiver)
+{
+    auto priv = d;
+    d->db.exec(QStringLiteral("SELECT lo_open($1::oid, $2)"), {qint64(d->oid), int(mode)},
+               [priv, cb] (AResult &result) {
+        if (!result.error() && result.size()) {
+            priv->fd = result.begin()[0].toInt();
+        }
+        if (cb) {
+            cb(result);
+        }
+    }, receiver);
+}
+
+void ALargeObject::read(int size, AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT loread($1, $2)"), {d->fd, size}, cb, receiver);
+}
+
+void ALargeObject::write(const QByteArray &data, AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT lowrite($1, $2)"), {d->fd, data}, cb, receiver);
+}
+
+void ALargeObject::seek(qint64 offset, SeekWhence whence, AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT lo_lseek64($1, $2, $3)"), {d->fd, offset, int(whence)}, cb, receiver);
+}
+
+void ALargeObject::tell(AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT lo_tell64($1)"), {d->fd}, cb, receiver);
+}
+
+void ALargeObject::truncate(qint64 size, AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT lo_truncate64($1, $2)"), {d->fd, size}, cb, receiver);
+}
+
+void ALargeObject::close(AResultFn cb, QObject *receiver)
+{
+    const int fd = d->fd;
+    d->fd = -1;
+    d->db.exec(QStringLiteral("SELECT lo_close($1)"), {fd}, cb, receiver);
+}
+
+void ALargeObject::unlink(AResultFn cb, QObject *receiver)
+{
+    d->db.exec(QStringLiteral("SELECT lo_unlink($1::oid)"), {qint64(d->oid)}, cb, receiver);
+}
+
+void ALargeObject::readToDevice(QIODevice *device, AResultFn cb, QObject *receiver, int chunkSize)
+{
+    auto transfer = std::make_shared<ATransfer>();
+    transfer->d = d;
+    transfer->device = device;
+    transfer->cb = cb;
+    transfer->receiver = receiver;
+    transfer->chunkSize = qMax(1, chunkSize);
+
+    for (int i = 0; i < transferWindow; ++i) {
+        readChunk(transfer);
+    }
+}
+
+void ALargeObject::writeFromDevice(QIODevice *device, AResultFn cb, QObject *receiver, int chunkSize)
+{
+    auto transfer = std::make_shared<ATransfer>();
+    transfer->d = d;
+    transfer->device = device;
+    transfer->cb = cb;
+    transfer->receiver = receiver;
+    transfer->chunkSize = qMax(1, chunkSize);
+
+    for (int i = 0; i < transferWindow && !transfer->done; ++i) {
+        writeChunk(transfer);
+    }
+}
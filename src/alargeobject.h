@@ -0,0 +1,144 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ALARGEOBJECT_H
+#define ALARGEOBJECT_H
+
+#include <adatabase.h>
+
+#include <memory>
+
+#include <asqlexports.h>
+
+class QIODevice;
+
+namespace ASql {
+
+class ALargeObjectPrivate;
+
+/*!
+ * \brief The ALargeObject class provides async access to PostgreSQL large objects
+ *
+ * All operations use the server side lo_* functions through the regular query path,
+ * so they are queued like any other query on the connection. Large object descriptors
+ * are only valid inside a transaction, so a transaction must be started before calling
+ * open() and committed after close().
+ *
+ * Each operation depends on the previous one, for example the descriptor is only known
+ * after open() finishes, so they must be chained from the callbacks. readToDevice() and
+ * writeFromDevice() stream the whole object in chunks without holding it in memory.
+ *
+ * \code{.cpp}
+ * db.begin();
+ * ALargeObject lo(db, oid);
+ * lo.open(ALargeObject::ReadOnly, [=] (AResult &result) mutable {
+ *     lo.readToDevice(file, [=] (AResult &result) mutable {
+ *         lo.close();
+ *         db.commit();
+ *     });
+ * });
+ * \endcode
+ */
+class ASQL_EXPORT ALargeObject
+{
+public:
+    enum OpenMode {
+        ReadOnly = 0x40000,
+        WriteOnly = 0x20000,
+        ReadWrite = ReadOnly | WriteOnly,
+    };
+
+    enum SeekWhence {
+        SeekSet = 0,
+        SeekCurrent = 1,
+        SeekEnd = 2,
+    };
+
+    /*!
+     * \brief ALargeObject constructs a large object accessor, create() must be called to get an oid
+     * \param db
+     */
+    explicit ALargeObject(const ADatabase &db);
+
+    /*!
+     * \brief ALargeObject constructs an accessor for the existing object \p oid
+     * \param db
+     * \param oid
+     */
+    ALargeObject(const ADatabase &db, quint32 oid);
+
+    quint32 oid() const;
+    bool isOpen() const;
+
+    /*!
+     * \brief create creates a new empty large object, once done oid() has its oid
+     */
+    void create(AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief open opens the large object, must be called inside a transaction
+     */
+    void open(OpenMode mode, AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief read reads up to \p size bytes, the data is available as bytea on the first column of the result
+     */
+    void read(int size, AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief write writes \p data at the current position
+     */
+    void write(const QByteArray &data, AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief seek changes the current position, the result has the new position
+     */
+    void seek(qint64 offset, SeekWhence whence, AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief tell the result has the current position
+     */
+    void tell(AResultFn cb, QObject *receiver = nullptr);
+
+    /*!
+     * \brief truncate truncates the large object to \p size bytes
+     */
+    void truncate(qint64 size, AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief close closes the descriptor, it's also closed at the end of the transaction
+     */
+    void close(AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief unlink removes the large object from the database
+     */
+    void unlink(AResultFn cb = {}, QObject *receiver = nullptr);
+
+    /*!
+     * \brief readToDevice reads from the current position to the end of the object
+     * writing it to \p device in chunks of \p chunkSize bytes
+     *
+     * Two reads are kept in flight to hide the round trip latency, \p device must outlive
+     * the transfer, \p cb is called once done or on the first error.
+     */
+    void readToDevice(QIODevice *device, AResultFn cb, QObject *receiver = nullptr, int chunkSize = 256 * 1024);
+
+    /*!
+     * \brief writeFromDevice writes everything that can be read from \p device
+     * at the current position in chunks of \p chunkSize bytes
+     *
+     * Two writes are kept in flight to hide the round trip latency, \p device must outlive
+     * the transfer and have all the data available, \p cb is called once done or on the first error.
+     */
+    void writeFromDevice(QIODevice *device, AResultFn cb, QObject *receiver = nullptr, int chunkSize = 256 * 1024);
+
+private:
+    std::shared_ptr<ALargeObjectPrivate> d;
+};
+
+}
+
+#endif // ALARGEOBJECT_H
@@ -53,16 +53,18 @@ ADatabase APg::database(const QString &connectionInfo)
 ADriver *APg::createRawDriver() const
 {
     auto ret = new ADriverPg(d->connection);
+    ret->setConnectionLimiter(connectionLimiter());
     return ret;
 }
 
 std::shared_ptr<ADriver> APg::createDriver() const
 {
     auto ret = std::make_shared<ADriverPg>(d->connection);
+    ret->setConnectionLimiter(connectionLimiter());
     return ret;
 }
 
 ADatabase APg::createDatabase() const
 {
-    return ADatabase(std::make_shared<ADriverPg>(d->connection));
+    return ADatabase(createDriver());
 }
@@ -6,7 +6,10 @@
 #include "apool.h"
 #include "adriver.h"
 #include "adriverfactory.h"
+#include "aresult.h"
+#include "aresultvalues.h"
 
+#include <QElapsedTimer>
 #include <QPointer>
 #include <QQueue>
 #include <QObject>
@@ -19,9 +22,15 @@ using namespace ASql;
 struct APoolQueuedClient {
     std::function<void (ADatabase &)> cb;
     QPointer<QObject> receiver;
+    QString tenant;
     bool checkReceiver;
 };
 
+struct APoolQueryStats {
+    double averageMs = 0;
+    quint64 count = 0;
+};
+
 struct APoolInternal {
     QString name;
     std::shared_ptr<ADriverFactory> driverFactory;
@@ -29,8 +38,18 @@ struct APoolInternal {
     QQueue<APoolQueuedClient> connectionQueue;
     std::function<void (ADatabase &)> setupCb;
     std::function<void (ADatabase &)> reuseCb;
+    qint64 maxResultSize = 0;
+    qint64 maxResultRows = 0;
+    ADatabase::ResultLimitAction resultLimitAction = ADatabase::ResultLimitAction::Abort;
+    QHash<QString, QString> sessionParameters;
+    QHash<ADriver *, QString> driverTenant;
+    QHash<QString, int> tenantConnections;
+    QHash<uint, APoolQueryStats> queryStats;
+    QString slowPool;
+    int slowQueryThresholdMs = 0;
     int maxIdleConnections = 1;
     int maximuConnections = 0;
+    int maxTenantConnections = 0;
     int connectionCount = 0;
 };
 
@@ -38,6 +57,73 @@ static thread_local QHash<QStringView, APoolInternal> m_connectionPool;
 
 const QStringView APool::defaultPool = u"asql_default_pool";
 
+static void setupDriver(APoolInternal &iPool, ADriver *driver, const QString &tenant)
+{
+    driver->setResultLimit(iPool.maxResultSize, iPool.resultLimitAction, iPool.maxResultRows);
+    if (tenant.isEmpty()) {
+        iPool.driverTenant.remove(driver);
+        driver->setSessionParameters(iPool.sessionParameters);
+    } else {
+        // The driver only sends search_path if the connection had another tenant
+        auto parameters = iPool.sessionParameters;
+        parameters.insert(QStringLiteral("search_path"), tenant);
+        driver->setSessionParameters(parameters);
+        iPool.driverTenant.insert(driver, tenant);
+        ++iPool.tenantConnections[tenant];
+    }
+}
+
+static bool tenantLimitReached(const APoolInternal &iPool, const QString &tenant)
+{
+    return !tenant.isEmpty() && iPool.maxTenantConnections && iPool.tenantConnections.value(tenant) >= iPool.maxTenantConnections;
+}
+
+/*
+ * Normalizes literals and white space so the same query with
+ * different values has the same fingerprint
+ */
+static uint queryFingerprint(const QString &query)
+{
+    QString normalized;
+    normalized.reserve(query.size());
+    const int size = query.size();
+    for (int i = 0; i < size; ++i) {
+        const QChar c = query.at(i);
+        if (c == QLatin1Char('\'')) {
+            // skip the string literal, doubled quotes are escapes
+            while (++i < size) {
+                if (query.at(i) == QLatin1Char('\'')) {
+                    if (i + 1 < size && query.at(i + 1) == QLatin1Char('\'')) {
+                        ++i;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            normalized.append(QLatin1Char('?'));
+        } else if (c.isDigit() && (normalized.isEmpty() || !(normalized.back().isLetterOrNumber() || normalized.back() == QLatin1Char('_') || normalized.back() == QLatin1Char('$')))) {
+            while (i + 1 < size && (query.at(i + 1).isDigit() || query.at(i + 1) == QLatin1Char('.'))) {
+                ++i;
+            }
+            normalized.append(QLatin1Char('?'));
+        } else if (c.isSpace()) {
+            if (!normalized.isEmpty() && normalized.back() != QLatin1Char(' ')) {
+                normalized.append(QLatin1Char(' '));
+            }
+        } else {
+            normalized.append(c);
+        }
+    }
+    return qHash(normalized.trimmed());
+}
+
+static QStringView poolKey(const QString &poolName)
+{
+    // connections keep a view of the pool name, so use the one owned by the pool
+    auto it = m_connectionPool.constFind(poolName);
+    return it != m_connectionPool.constEnd() ? it.key() : QStringView(poolName);
+}
+
 void APool::create(const std::shared_ptr<ADriverFactory> &factory, QStringView poolName)
 {
     APool::create(factory, poolName.toString());
@@ -60,35 +146,52 @@ void APool::remove(QStringView poolName)
     m_connectionPool.remove(poolName);
 }
 
-void APool::pushDatabaseBack(QStringView connectionName, ADriver *driver)
+void APool::pushDatabaseBack(QStringView connectionName, ADriver *driver, const QString &tenant)
 {
     auto it = m_connectionPool.find(connectionName);
     if (it != m_connectionPool.end()) {
         APoolInternal &iPool = it.value();
+        if (!tenant.isEmpty()) {
+            auto tenantIt = iPool.tenantConnections.find(tenant);
+            if (tenantIt != iPool.tenantConnections.end() && --tenantIt.value() <= 0) {
+                iPool.tenantConnections.erase(tenantIt);
+            }
+        }
+
         if (driver->state() == ADatabase::State::Disconnected) {
             qDebug(ASQL_POOL) << "Deleting database connection as is not open" << driver->isOpen();
+            iPool.driverTenant.remove(driver);
             delete driver;
             --iPool.connectionCount;
             return;
         }
 
-        // Check for waiting clients
-        while (!iPool.connectionQueue.isEmpty()) {
-            APoolQueuedClient client = iPool.connectionQueue.dequeue();
-            if ((client.checkReceiver && client.receiver.isNull()) || !client.cb) {
+        // Check for waiting clients, skipping the ones whose tenant is at its limit
+        for (int i = 0; i < iPool.connectionQueue.size(); ++i) {
+            const APoolQueuedClient &queued = iPool.connectionQueue.at(i);
+            if ((queued.checkReceiver && queued.receiver.isNull()) || !queued.cb) {
+                iPool.connectionQueue.removeAt(i--);
                 continue;
             }
 
+            if (tenantLimitReached(iPool, queued.tenant)) {
+                continue;
+            }
+
+            APoolQueuedClient client = iPool.connectionQueue.takeAt(i);
+            const QString clientTenant = client.tenant;
             ADatabase db;
-            db.d = std::shared_ptr<ADriver>(driver, [connectionName] (ADriver *driver) {
-                    pushDatabaseBack(connectionName, driver);
+            db.d = std::shared_ptr<ADriver>(driver, [connectionName, clientTenant] (ADriver *driver) {
+                    pushDatabaseBack(connectionName, driver, clientTenant);
             });
+            setupDriver(iPool, driver, clientTenant);
             client.cb(db);
             return;
         }
 
         if (iPool.pool.size() >= iPool.maxIdleConnections) {
             qDebug(ASQL_POOL) << "Deleting database connection due max idle connections" << iPool.maxIdleConnections << iPool.pool.size();
+            iPool.driverTenant.remove(driver);
             delete driver;
             --iPool.connectionCount;
         } else {
@@ -116,6 +219,7 @@ ADatabase APool::database(QStringView poolName)
                 db.d = std::shared_ptr<ADriver>(driver, [poolName] (ADriver *driver) {
                     pushDatabaseBack(poolName, driver);
                 });
+                setupDriver(iPool, driver, {});
 
                 if (iPool.setupCb) {
                     iPool.setupCb(db);
@@ -127,6 +231,7 @@ ADatabase APool::database(QStringView poolName)
             db.d = std::shared_ptr<ADriver>(driver, [poolName] (ADriver *driver) {
                 pushDatabaseBack(poolName, driver);
             });
+            setupDriver(iPool, driver, {});
 
             if (iPool.reuseCb) {
                 iPool.reuseCb(db);
@@ -169,6 +274,7 @@ void APool::database(std::function<void (ADatabase &)> cb, QObject *receiver, QS
             db.d = std::shared_ptr<ADriver>(iPool.driverFactory->createRawDriver(), [poolName] (ADriver *driver) {
                     pushDatabaseBack(poolName, driver);
             });
+            setupDriver(iPool, db.d.get(), {});
 
             if (iPool.setupCb) {
                 iPool.setupCb(db);
@@ -179,6 +285,7 @@ void APool::database(std::function<void (ADatabase &)> cb, QObject *receiver, QS
             db.d = std::shared_ptr<ADriver>(priv, [poolName] (ADriver *driver) {
                     pushDatabaseBack(poolName, driver);
             });
+            setupDriver(iPool, priv, {});
 
             if (iPool.reuseCb) {
                 iPool.reuseCb(db);
@@ -194,6 +301,95 @@ void APool::database(std::function<void (ADatabase &)> cb, QObject *receiver, QS
     }
 }
 
+void APool::databaseForTenant(const QString &tenant, std::function<void (ADatabase &)> cb, QObject *receiver, QStringView poolName)
+{
+    ADatabase db;
+    auto it = m_connectionPool.find(poolName);
+    if (it != m_connectionPool.end()) {
+        APoolInternal &iPool = it.value();
+        const bool maxReached = iPool.maximuConnections && iPool.connectionCount >= iPool.maximuConnections;
+        if (tenantLimitReached(iPool, tenant) || (iPool.pool.empty() && maxReached)) {
+            qInfo(ASQL_POOL) << "Maximum number of connections reached, queuing" << poolName << tenant
+                             << iPool.tenantConnections.value(tenant) << iPool.connectionCount;
+            APoolQueuedClient queued;
+            queued.cb = cb;
+            queued.receiver = receiver;
+            queued.checkReceiver = receiver;
+            queued.tenant = tenant;
+            iPool.connectionQueue.enqueue(queued);
+            return;
+        }
+
+        // Prefer the most recent idle connection of this tenant, then untagged ones, then the oldest one
+        int index = -1;
+        for (int i = iPool.pool.size() - 1; i >= 0; --i) {
+            const auto tagIt = iPool.driverTenant.constFind(iPool.pool[i]);
+            if (tagIt == iPool.driverTenant.constEnd()) {
+                if (index == -1) {
+                    index = i;
+                }
+            } else if (tagIt.value() == tenant) {
+                index = i;
+                break;
+            }
+        }
+        if (index == -1 && !iPool.pool.empty()) {
+            index = 0;
+        }
+
+        if (index == -1) {
+            ++iPool.connectionCount;
+            qDebug(ASQL_POOL) << "Creating a database connection for pool" << poolName << tenant;
+            db.d = std::shared_ptr<ADriver>(iPool.driverFactory->createRawDriver(), [poolName, tenant] (ADriver *driver) {
+                    pushDatabaseBack(poolName, driver, tenant);
+            });
+            setupDriver(iPool, db.d.get(), tenant);
+
+            if (iPool.setupCb) {
+                iPool.setupCb(db);
+            }
+        } else {
+            ADriver *priv = iPool.pool.takeAt(index);
+            qDebug(ASQL_POOL) << "Reusing a database connection from pool" << poolName << tenant
+                              << "previous tenant" << iPool.driverTenant.value(priv);
+            db.d = std::shared_ptr<ADriver>(priv, [poolName, tenant] (ADriver *driver) {
+                    pushDatabaseBack(poolName, driver, tenant);
+            });
+            setupDriver(iPool, priv, tenant);
+
+            if (iPool.reuseCb) {
+                iPool.reuseCb(db);
+            }
+        }
+    } else {
+        qCritical(ASQL_POOL) << "Database pool NOT FOUND" << poolName;
+    }
+    db.open();
+
+    if (cb) {
+        cb(db);
+    }
+}
+
+void APool::databaseAtLsn(const QString &lsn, int timeoutMs, std::function<void (ADatabase &)> cb, QObject *receiver,
+                          QStringView replicaPool, QStringView primaryPool)
+{
+    const QString primary = primaryPool.toString();
+    APool::database([=] (ADatabase &replica) {
+        replica.waitForLsn(lsn, timeoutMs, [=] (AResult &result) mutable {
+            if (!result.error() && result.size() && result.begin()[0].toBool()) {
+                if (cb) {
+                    cb(replica);
+                }
+                return;
+            }
+
+            qCInfo(ASQL_POOL) << "Replica did not replay LSN in time, using primary" << lsn << result.errorString();
+            APool::database(cb, receiver, poolKey(primary));
+        }, receiver);
+    }, receiver, replicaPool);
+}
+
 void APool::setMaxIdleConnections(int max, QStringView poolName)
 {
     auto it = m_connectionPool.find(poolName);
@@ -214,6 +410,262 @@ void APool::setMaxConnections(int max, QStringView poolName)
     }
 }
 
+void APool::exec(const QString &query, AResultFn cb, QObject *receiver, QStringView poolName)
+{
+    APool::exec(query, QVariantList(), cb, receiver, poolName);
+}
+
+void APool::exec(const QString &query, const QVariantList &params, AResultFn cb, QObject *receiver, QStringView poolName)
+{
+    auto it = m_connectionPool.find(poolName);
+    if (it == m_connectionPool.end()) {
+        // database() reports the missing pool and returns an invalid connection
+        APool::database([=] (ADatabase &db) {
+            db.exec(query, params, cb, receiver);
+        }, receiver, poolName);
+        return;
+    }
+
+    APoolInternal &iPool = it.value();
+    const uint fingerprint = queryFingerprint(query);
+    const QString statsPool = iPool.name;
+    QString targetPool = iPool.name;
+    if (!iPool.slowPool.isEmpty() && iPool.slowQueryThresholdMs > 0) {
+        auto statsIt = iPool.queryStats.constFind(fingerprint);
+        if (statsIt != iPool.queryStats.constEnd() && statsIt.value().averageMs > iPool.slowQueryThresholdMs) {
+            qDebug(ASQL_POOL) << "Routing slow query to pool" << iPool.slowPool << statsIt.value().averageMs << query;
+            targetPool = iPool.slowPool;
+        }
+    }
+
+    APool::database([=] (ADatabase &db) {
+        // The time spent waiting for a connection or connecting is not the query's fault,
+        // the timer starts at dispatch and new connections don't feed the history
+        const bool measure = db.isOpen();
+        auto timer = std::make_shared<QElapsedTimer>();
+        timer->start();
+        db.exec(query, params, [=] (AResult &result) {
+            if (measure && result.lastResulSet()) {
+                auto statsIt = m_connectionPool.find(statsPool);
+                if (statsIt != m_connectionPool.end()) {
+                    QHash<uint, APoolQueryStats> &stats = statsIt.value().queryStats;
+                    if (stats.size() >= 4096 && !stats.contains(fingerprint)) {
+                        stats.erase(stats.begin());
+                    }
+
+                    // exponential moving average so queries can move back once they get faster
+                    APoolQueryStats &entry = stats[fingerprint];
+                    const double elapsed = timer->nsecsElapsed() / 1000000.0;
+                    entry.averageMs = entry.count ? entry.averageMs * 0.8 + elapsed * 0.2 : elapsed;
+                    ++entry.count;
+                }
+            }
+
+            if (cb) {
+                cb(result);
+            }
+        }, receiver);
+    }, receiver, poolKey(targetPool));
+}
+
+struct APoolScan {
+    QString query;
+    QString column;
+    QVector<QPair<QVariant, QVariant>> ranges;
+    APartitionResultFn cb;
+    QPointer<QObject> receiver;
+    QObject *checkReceiver;
+    QString poolName;
+    QString snapshot;
+    ADatabase leader;
+    QString errorString;
+    int next = 0;
+    int running = 0;
+    bool error = false;
+    bool singleRow = false;
+};
+
+static QString quoteIdentifier(const QString &identifier)
+{
+    QString ret = identifier;
+    ret.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + ret + QLatin1Char('"');
+}
+
+static bool scanReceiverAlive(const std::shared_ptr<APoolScan> &scan)
+{
+    return !scan->checkReceiver || !scan->receiver.isNull();
+}
+
+static void finishScan(const std::shared_ptr<APoolScan> &scan)
+{
+    if (scan->leader.isValid()) {
+        // the snapshot must stay exported until every connection imported it
+        scan->leader.commit();
+        scan->leader = ADatabase();
+    }
+
+    qCDebug(ASQL_POOL) << "Parallel scan finished" << scan->ranges.size() << scan->errorString;
+    if (scan->cb && scanReceiverAlive(scan)) {
+        auto values = std::make_shared<AResultValues>(QStringList());
+        if (scan->error) {
+            values->setError(scan->errorString);
+        }
+        AResult result(values);
+        scan->cb(-1, result);
+    }
+}
+
+static void scanNext(const std::shared_ptr<APoolScan> &scan, ADatabase db, bool leader)
+{
+    if (scan->error || !scanReceiverAlive(scan)) {
+        scan->next = scan->ranges.size();
+    }
+
+    if (scan->next >= scan->ranges.size()) {
+        if (!scan->snapshot.isEmpty() && !leader) {
+            db.commit();
+        }
+
+        if (--scan->running == 0) {
+            finishScan(scan);
+        }
+        return;
+    }
+
+    const int partition = scan->next++;
+    const auto &range = scan->ranges.at(partition);
+    const QString column = quoteIdentifier(scan->column);
+    QString query = QLatin1String("SELECT * FROM (") + scan->query + QLatin1String(") asql_scan");
+    QVariantList params;
+    if (!range.first.isNull()) {
+        params.append(range.first);
+        query += QLatin1String(" WHERE ") + column + QLatin1String(" >= $1");
+    }
+    if (!range.second.isNull()) {
+        params.append(range.second);
+        query += (params.size() == 1 ? QLatin1String(" WHERE ") : QLatin1String(" AND ")) +
+                column + QLatin1String(" < $") + QString::number(params.size());
+    }
+
+    qCDebug(ASQL_POOL) << "Parallel scan of partition" << partition << range.first << range.second;
+    // No receiver, the connection must go on to commit even if the receiver is gone
+    db.exec(query, params, [scan, db, leader, partition] (AResult &result) {
+        if (result.error() && !scan->error) {
+            scan->error = true;
+            scan->errorString = result.errorString();
+        }
+
+        if (scan->cb && scanReceiverAlive(scan)) {
+            scan->cb(partition, result);
+        }
+
+        if (result.lastResulSet()) {
+            scanNext(scan, db, leader);
+        }
+    });
+
+    if (scan->singleRow) {
+        db.setLastQuerySingleRowMode();
+    }
+}
+
+static void startScanWorkers(const std::shared_ptr<APoolScan> &scan, int workers)
+{
+    for (int i = 0; i < workers; ++i) {
+        APool::database([scan] (ADatabase &db) {
+            // Workers only count once they get a connection, so the scan doesn't wait for
+            // the ones still queued in the pool, which might be waiting for the leader's
+            if (scan->next >= scan->ranges.size()) {
+                return;
+            }
+            ++scan->running;
+
+            if (!scan->snapshot.isEmpty()) {
+                QString snapshot = scan->snapshot;
+                snapshot.replace(QLatin1Char('\''), QLatin1String("''"));
+                const QString setSnapshot = QLatin1String("SET TRANSACTION SNAPSHOT '") + snapshot + QLatin1Char('\'');
+                db.exec(u"BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY", {});
+                db.exec(setSnapshot, [scan] (AResult &result) {
+                    if (result.error() && !scan->error) {
+                        qCWarning(ASQL_POOL) << "Failed to import snapshot" << scan->snapshot << result.errorString();
+                        scan->error = true;
+                        scan->errorString = result.errorString();
+                    }
+                });
+            }
+            scanNext(scan, db, false);
+        }, nullptr, poolKey(scan->poolName));
+    }
+}
+
+void APool::parallelScan(const QString &query, const QString &partitionColumn, const QVector<QPair<QVariant, QVariant>> &ranges,
+                         int connections, APartitionResultFn cb, QObject *receiver, ParallelScanOptions options, QStringView poolName)
+{
+    auto scan = std::make_shared<APoolScan>();
+    scan->query = query;
+    scan->column = partitionColumn;
+    scan->ranges = ranges;
+    scan->cb = cb;
+    scan->receiver = receiver;
+    scan->checkReceiver = receiver;
+    scan->poolName = poolName.toString();
+    scan->singleRow = options & SingleRowMode;
+
+    const int workers = qBound(1, connections, qMax(1, ranges.size()));
+    if (ranges.isEmpty()) {
+        finishScan(scan);
+        return;
+    }
+
+    if (!(options & SharedSnapshot)) {
+        startScanWorkers(scan, workers);
+        return;
+    }
+
+    APool::database([scan, workers] (ADatabase &db) {
+        db.exec(u"BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY", {});
+        db.exec(u"SELECT pg_export_snapshot()", [scan, db, workers] (AResult &result) {
+            if (result.error() || !result.size()) {
+                qCWarning(ASQL_POOL) << "Failed to export snapshot" << result.errorString();
+                ADatabase(db).rollback();
+                scan->error = true;
+                scan->errorString = result.errorString();
+                finishScan(scan);
+                return;
+            }
+
+            scan->snapshot = result.begin()[0].toString();
+            scan->leader = db;
+            ++scan->running;
+            qCDebug(ASQL_POOL) << "Parallel scan exported snapshot" << scan->snapshot;
+            startScanWorkers(scan, workers - 1);
+            scanNext(scan, db, true);
+        });
+    }, nullptr, poolKey(scan->poolName));
+}
+
+void APool::setSlowQueryPool(QStringView slowPool, int thresholdMs, QStringView poolName)
+{
+    auto it = m_connectionPool.find(poolName);
+    if (it != m_connectionPool.end()) {
+        it.value().slowPool = slowPool.toString();
+        it.value().slowQueryThresholdMs = thresholdMs;
+    } else {
+        qCritical(ASQL_POOL) << "Failed to set slow query pool: Database pool NOT FOUND" << poolName;
+    }
+}
+
+void APool::setMaxConnectionsPerTenant(int max, QStringView poolName)
+{
+    auto it = m_connectionPool.find(poolName);
+    if (it != m_connectionPool.end()) {
+        it.value().maxTenantConnections = max;
+    } else {
+        qCritical(ASQL_POOL) << "Failed to set maximum connections per tenant: Database pool NOT FOUND" << poolName;
+    }
+}
+
 void APool::setSetupCallback(std::function<void (ADatabase &)> cb, QStringView poolName)
 {
     auto it = m_connectionPool.find(poolName);
@@ -233,3 +685,30 @@ void APool::setReuseCallback(std::function<void (ADatabase &)> cb, QStringView p
         qCritical(ASQL_POOL) << "Failed to set maximum connections: Database pool NOT FOUND" << poolName;
     }
 }
+
+void APool::setSessionParameters(const QHash<QString, QString> &parameters, QStringView poolName)
+{
+    auto it = m_connectionPool.find(poolName);
+    if (it != m_connectionPool.end()) {
+        it.value().sessionParameters = parameters;
+    } else {
+        qCritical(ASQL_POOL) << "Failed to set session parameters: Database pool NOT FOUND" << poolName;
+    }
+}
+
+void APool::setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action, QStringView poolName)
+{
+    APool::setResultLimit(maxBytes, 0, action, poolName);
+}
+
+void APool::setResultLimit(qint64 maxBytes, qint64 maxRows, ADatabase::ResultLimitAction action, QStringView poolName)
+{
+    auto it = m_connectionPool.find(poolName);
+    if (it != m_connectionPool.end()) {
+        it.value().maxResultSize = maxBytes;
+        it.value().maxResultRows = maxRows;
+        it.value().resultLimitAction = action;
+    } else {
+        qCritical(ASQL_POOL) << "Failed to set result limit: Database pool NOT FOUND" << poolName;
+    }
+}
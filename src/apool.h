@@ -16,9 +16,18 @@
 
 namespace ASql {
 
+using APartitionResultFn = std::function<void(int partition, AResult &result)>;
+
 class ASQL_EXPORT APool
 {
 public:
+    enum ParallelScanOption {
+        NoScanOptions = 0x0,
+        SharedSnapshot = 0x1,
+        SingleRowMode = 0x2,
+    };
+    Q_DECLARE_FLAGS(ParallelScanOptions, ParallelScanOption)
+
     static const QStringView defaultPool;
 
     /*!
@@ -83,6 +92,41 @@ public:
      */
     static void database(std::function<void(ADatabase &database)>, QObject *receiver = nullptr, QStringView poolName = defaultPool);
 
+    /*!
+     * \brief databaseForTenant retrieves a database object for schema-per-tenant deployments
+     *
+     * Idle connections remember the last \p tenant they were used for, and one already used by
+     * \p tenant is preferred, otherwise an untagged or the oldest idle connection is reused.
+     * The tenant is declared as the "search_path" session parameter, see \sa setSessionParameters(),
+     * so it's only sent when the connection had a different tenant, keeping the plans cached on
+     * the backend valid.
+     *
+     * If the pool or the tenant reached their maximum number of connections the request is queued
+     * until a connection is returned to the pool.
+     *
+     * \param tenant the search_path value of the tenant, like "tenant_1, public"
+     * \param receiver
+     * \param poolName
+     */
+    static void databaseForTenant(const QString &tenant, std::function<void(ADatabase &database)> cb, QObject *receiver = nullptr,
+                                  QStringView poolName = defaultPool);
+
+    /*!
+     * \brief databaseAtLsn retrieves a database object that already sees the writes up to \p lsn
+     *
+     * A connection from \p replicaPool is used once it has replayed the write-ahead log up to \p lsn,
+     * if that doesn't happen within \p timeoutMs a connection from \p primaryPool is used instead,
+     * this allows reading your own writes from replicas without seeing stale data.
+     *
+     * \param lsn a position returned by \sa ADatabase::currentWalLsn() after the writes were committed
+     * \param timeoutMs
+     * \param receiver
+     * \param replicaPool
+     * \param primaryPool
+     */
+    static void databaseAtLsn(const QString &lsn, int timeoutMs, std::function<void(ADatabase &database)> cb, QObject *receiver = nullptr,
+                              QStringView replicaPool = defaultPool, QStringView primaryPool = defaultPool);
+
     /*!
      * \brief setMaxIdleConnections maximum number of idle connections of the pool
      *
@@ -107,6 +151,87 @@ public:
      */
     static void setMaxConnections(int max, QStringView poolName = defaultPool);
 
+    /*!
+     * \brief exec executes \p query on a connection of the pool, tracking how long it takes
+     *
+     * The duration of each query is kept per fingerprint, the query text with its literals
+     * removed, if its average exceeds the threshold set with \sa setSlowQueryPool() the query
+     * runs on the slow pool instead, so a few heavy queries don't hold the connections
+     * needed by the cheap ones. A connection is retrieved with \sa database() using a callback,
+     * so the query is queued if the pool is at its maximum number of connections.
+     *
+     * \param query
+     * \param params
+     * \param cb
+     * \param receiver
+     * \param poolName
+     */
+    static void exec(const QString &query, const QVariantList &params, AResultFn cb, QObject *receiver = nullptr, QStringView poolName = defaultPool);
+
+    static void exec(const QString &query, AResultFn cb, QObject *receiver = nullptr, QStringView poolName = defaultPool);
+
+    /*!
+     * \brief setSlowQueryPool routes queries executed with \sa exec() on \p poolName
+     * to \p slowPool once their average duration exceeds \p thresholdMs
+     *
+     * \p slowPool must be created with the same driver factory, its own limit set
+     * with \sa setMaxConnections() bounds how many connections heavy queries use.
+     *
+     * Only queries executed with \sa exec() feed the duration history, timed from the moment
+     * they are sent on an already open connection, queries executed on a connection obtained
+     * with \sa database() are neither measured nor routed.
+     *
+     * \param slowPool
+     * \param thresholdMs 0 disables the routing
+     * \param poolName
+     */
+    static void setSlowQueryPool(QStringView slowPool, int thresholdMs, QStringView poolName = defaultPool);
+
+    /*!
+     * \brief parallelScan splits \p query into one query per range of \p partitionColumn and
+     * runs them on up to \p connections connections of the pool at the same time
+     *
+     * Each range is half open, rows with \p partitionColumn greater or equal than the first value
+     * and lower than the second, a null value leaves that side open. When there are more ranges
+     * than connections each connection runs the next pending range once it's done.
+     *
+     * \p cb is called with the index of the range and its results, with SingleRowMode each row
+     * is delivered as soon as it arrives and the last result of a range is empty with
+     * \sa AResult::lastResulSet() set, results of different ranges are interleaved. Once all
+     * ranges are done \p cb is called a last time with partition -1, the result has the
+     * error of the first range that failed, if any, which also stops the remaining ranges.
+     *
+     * With SharedSnapshot the first connection exports its REPEATABLE READ snapshot with
+     * pg_export_snapshot() and the others import it, so all ranges see the same data.
+     *
+     * Connections are used as the pool hands them out, if the pool is at its maximum the
+     * ranges run on fewer connections, and connections obtained after all ranges were
+     * taken go back to the pool without running anything.
+     *
+     * \param query a query without parameters
+     * \param partitionColumn column of \p query used to split the ranges
+     * \param ranges
+     * \param connections
+     * \param cb
+     * \param receiver
+     * \param options
+     * \param poolName
+     */
+    static void parallelScan(const QString &query, const QString &partitionColumn, const QVector<QPair<QVariant, QVariant>> &ranges,
+                             int connections, APartitionResultFn cb, QObject *receiver = nullptr,
+                             ParallelScanOptions options = NoScanOptions, QStringView poolName = defaultPool);
+
+    /*!
+     * \brief setMaxConnectionsPerTenant maximum number of connections a single tenant can use at the same time
+     *
+     * The default value is 0, which means ilimited, once reached \sa databaseForTenant() requests of
+     * that tenant are queued, so a busy tenant doesn't take all the connections of the pool.
+     *
+     * \param max
+     * \param poolName
+     */
+    static void setMaxConnectionsPerTenant(int max, QStringView poolName = defaultPool);
+
     /*!
      * \brief setSetupCallback setup a connection before being used for the first time
      *
@@ -144,10 +269,42 @@ public:
      */
     static void setReuseCallback(std::function<void(ADatabase &database)> cb, QStringView poolName = defaultPool);
 
+    /*!
+     * \brief setResultLimit limits the memory used by query results on connections of this pool
+     *
+     * The limit is applied every time a connection is retrieved from the pool,
+     * see \sa ADatabase::setResultLimit() for details.
+     *
+     * \param maxBytes maximum result size, 0 disables the limit
+     * \param action
+     * \param poolName
+     */
+    static void setResultLimit(qint64 maxBytes, ADatabase::ResultLimitAction action = ADatabase::ResultLimitAction::Abort, QStringView poolName = defaultPool);
+
+    /*!
+     * \brief setResultLimit same as above, also limiting the number of rows to \p maxRows, 0 disables it
+     */
+    static void setResultLimit(qint64 maxBytes, qint64 maxRows, ADatabase::ResultLimitAction action, QStringView poolName = defaultPool);
+
+    /*!
+     * \brief setSessionParameters declares the run-time parameters of connections of this pool
+     *
+     * Every time a connection is retrieved from the pool its declared parameters are replaced by
+     * \p parameters, so values set with \sa ADatabase::setSessionParameter() for a previous user
+     * are reset. Unlike doing it on \sa setSetupCallback() or \sa setReuseCallback() nothing is sent
+     * until the next query, and only if the connection doesn't have these values already.
+     *
+     * \param parameters
+     * \param poolName
+     */
+    static void setSessionParameters(const QHash<QString, QString> &parameters, QStringView poolName = defaultPool);
+
 private:
-    inline static void pushDatabaseBack(QStringView connectionName, ADriver *driver);
+    inline static void pushDatabaseBack(QStringView connectionName, ADriver *driver, const QString &tenant = {});
 };
 
 }
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(ASql::APool::ParallelScanOptions)
+
 #endif // APOOL_H
@@ -8,9 +8,139 @@
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QDateTime>
+#include <QCborStreamWriter>
+#include <QtEndian>
+
+#include <cstring>
 
 using namespace ASql;
 
+namespace {
+
+/*
+ * Streaming XXH64, the four independent lanes keep the CPU pipelines busy
+ */
+class AXXHash64
+{
+public:
+    void update(const char *data, int size)
+    {
+        if (size <= 0) {
+            return;
+        }
+
+        m_total += quint64(size);
+        if (m_bufferSize + size < 32) {
+            memcpy(m_buffer + m_bufferSize, data, size_t(size));
+            m_bufferSize += size;
+            return;
+        }
+
+        const char *end = data + size;
+        if (m_bufferSize) {
+            const int fill = 32 - m_bufferSize;
+            memcpy(m_buffer + m_bufferSize, data, size_t(fill));
+            data += fill;
+            stripe(m_buffer);
+            m_bufferSize = 0;
+        }
+
+        while (end - data >= 32) {
+            stripe(data);
+            data += 32;
+        }
+
+        m_bufferSize = int(end - data);
+        memcpy(m_buffer, data, size_t(m_bufferSize));
+    }
+
+    inline void update(qint32 value)
+    {
+        char buffer[4];
+        qToLittleEndian<qint32>(value, buffer);
+        update(buffer, 4);
+    }
+
+    quint64 digest() const
+    {
+        quint64 h;
+        if (m_total >= 32) {
+            h = rotl(m_v1, 1) + rotl(m_v2, 7) + rotl(m_v3, 12) + rotl(m_v4, 18);
+            h = mergeRound(h, m_v1);
+            h = mergeRound(h, m_v2);
+            h = mergeRound(h, m_v3);
+            h = mergeRound(h, m_v4);
+        } else {
+            h = P5;
+        }
+        h += m_total;
+
+        const char *data = m_buffer;
+        const char *end = m_buffer + m_bufferSize;
+        while (end - data >= 8) {
+            h ^= round(0, qFromLittleEndian<quint64>(data));
+            h = rotl(h, 27) * P1 + P4;
+            data += 8;
+        }
+        if (end - data >= 4) {
+            h ^= quint64(qFromLittleEndian<quint32>(data)) * P1;
+            h = rotl(h, 23) * P2 + P3;
+            data += 4;
+        }
+        while (data < end) {
+            h ^= quint64(quint8(*data)) * P5;
+            h = rotl(h, 11) * P1;
+            ++data;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr quint64 P1 = 11400714785074694791ULL;
+    static constexpr quint64 P2 = 14029467366897019727ULL;
+    static constexpr quint64 P3 = 1609587929392839161ULL;
+    static constexpr quint64 P4 = 9650029242287828579ULL;
+    static constexpr quint64 P5 = 2870177450012600261ULL;
+
+    static inline quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static inline quint64 round(quint64 acc, quint64 input)
+    {
+        acc += input * P2;
+        return rotl(acc, 31) * P1;
+    }
+
+    static inline quint64 mergeRound(quint64 acc, quint64 value)
+    {
+        acc ^= round(0, value);
+        return acc * P1 + P4;
+    }
+
+    inline void stripe(const char *data)
+    {
+        m_v1 = round(m_v1, qFromLittleEndian<quint64>(data));
+        m_v2 = round(m_v2, qFromLittleEndian<quint64>(data + 8));
+        m_v3 = round(m_v3, qFromLittleEndian<quint64>(data + 16));
+        m_v4 = round(m_v4, qFromLittleEndian<quint64>(data + 24));
+    }
+
+    quint64 m_v1 = P1 + P2;
+    quint64 m_v2 = P2;
+    quint64 m_v3 = 0;
+    quint64 m_v4 = 0 - P1;
+    quint64 m_total = 0;
+    char m_buffer[32];
+    int m_bufferSize = 0;
+};
+
+}
+
 AResult::AResult() = default;
 
 AResult::AResult(const AResult &other)
@@ -75,6 +205,11 @@ QStringList AResult::columnNames() const
     return columns;
 }
 
+int AResult::columnType(int column) const
+{
+    return d->columnType(column);
+}
+
 QVariantHash AResult::toHash() const
 {
     QVariantHash ret;
@@ -140,6 +275,74 @@ QJsonArray AResult::toJsonArray() const
     return ret;
 }
 
+void AResult::toCbor(QCborStreamWriter &writer) const
+{
+    const int columns = fields();
+    writer.startMap(2);
+
+    writer.append(QLatin1String("columns"));
+    writer.startArray(quint64(columns));
+    for (int i = 0; i < columns; ++i) {
+        writer.append(fieldName(i));
+    }
+    writer.endArray();
+
+    writer.append(QLatin1String("rows"));
+    writer.startArray(quint64(size()));
+    toCborRows(writer);
+    writer.endArray();
+
+    writer.endMap();
+}
+
+QByteArray AResult::toCbor() const
+{
+    QByteArray ret;
+    QCborStreamWriter writer(&ret);
+    toCbor(writer);
+    return ret;
+}
+
+void AResult::toCborRows(QCborStreamWriter &writer) const
+{
+    const int rows = size();
+    const int columns = fields();
+    for (int row = 0; row < rows; ++row) {
+        writer.startArray(quint64(columns));
+        for (int i = 0; i < columns; ++i) {
+            d->toCbor(writer, row, i);
+        }
+        writer.endArray();
+    }
+}
+
+quint64 AResult::contentHash() const
+{
+    AXXHash64 hash;
+    const int columns = fields();
+    hash.update(columns);
+    for (int i = 0; i < columns; ++i) {
+        const QByteArray name = d->fieldName(i).toUtf8();
+        hash.update(name.size());
+        hash.update(name.constData(), name.size());
+    }
+
+    // each value is prefixed by its size so that adjacent values can't collide, -1 marks NULL
+    const int rows = size();
+    for (int row = 0; row < rows; ++row) {
+        for (int i = 0; i < columns; ++i) {
+            if (d->isNull(row, i)) {
+                hash.update(-1);
+            } else {
+                const QByteArray data = d->rawValue(row, i);
+                hash.update(data.size());
+                hash.update(data.constData(), data.size());
+            }
+        }
+    }
+    return hash.digest();
+}
+
 AResult &AResult::operator=(const AResult &copy)
 {
     d = copy.d;
@@ -188,6 +391,66 @@ int AResultPrivate::indexOfField(QLatin1String name) const
     return -1;
 }
 
+void AResultPrivate::toCbor(QCborStreamWriter &writer, int row, int column) const
+{
+    const QVariant data = value(row, column);
+    if (data.isNull()) {
+        writer.append(nullptr);
+        return;
+    }
+
+    switch (data.userType()) {
+    case QMetaType::Bool:
+        writer.append(data.toBool());
+        break;
+    case QMetaType::Int:
+    case QMetaType::LongLong:
+        writer.append(data.toLongLong());
+        break;
+    case QMetaType::UInt:
+    case QMetaType::ULongLong:
+        writer.append(data.toULongLong());
+        break;
+    case QMetaType::Double:
+        writer.append(data.toDouble());
+        break;
+    case QMetaType::QByteArray:
+        writer.append(data.toByteArray());
+        break;
+    case QMetaType::QDateTime:
+        writer.append(QCborKnownTags::DateTimeString);
+        writer.append(data.toDateTime().toUTC().toString(Qt::ISODateWithMs));
+        break;
+    default:
+        writer.append(data.toString());
+    }
+}
+
+int AResultPrivate::columnType(int column) const
+{
+    for (int row = 0; row < size(); ++row) {
+        if (!isNull(row, column)) {
+            return value(row, column).userType();
+        }
+    }
+    return QMetaType::QString;
+}
+
+QByteArray AResultPrivate::rawValue(int row, int column) const
+{
+    const QVariant data = value(row, column);
+    switch (data.userType()) {
+    case QMetaType::QByteArray:
+        return data.toByteArray();
+    case QMetaType::QDateTime:
+        return data.toDateTime().toString(Qt::ISODateWithMs).toUtf8();
+    case QMetaType::QTime:
+        return data.toTime().toString(Qt::ISODateWithMs).toUtf8();
+    default:
+        return data.toString().toUtf8();
+    }
+}
+
 QDate AResult::AColumn::toDate() const  { return d->toDate(row, column); }
 
 QTime AResult::AColumn::toTime() const  { return d->toTime(row, column); }
@@ -227,3 +490,13 @@ QJsonObject AResult::ARow::toJsonObject() const
     }
     return ret;
 }
+
+void AResult::ARow::toCbor(QCborStreamWriter &writer) const
+{
+    const int columns = d->fields();
+    writer.startArray(quint64(columns));
+    for (int i = 0; i < columns; ++i) {
+        d->toCbor(writer, row, i);
+    }
+    writer.endArray();
+}
@@ -11,6 +11,8 @@
 
 #include <asqlexports.h>
 
+class QCborStreamWriter;
+
 namespace ASql {
 
 class ASQL_EXPORT AResultPrivate
@@ -45,6 +47,24 @@ public:
     virtual QDateTime toDateTime(int row, int column) const = 0;
     virtual QJsonValue toJsonValue(int row, int column) const = 0;
     virtual QByteArray toByteArray(int row, int column) const = 0;
+
+    /*!
+     * \brief toCbor writes the value as a single CBOR item, the default implementation
+     * encodes the QVariant returned by value(), drivers can encode the raw data directly.
+     */
+    virtual void toCbor(QCborStreamWriter &writer, int row, int column) const;
+
+    /*!
+     * \brief columnType returns the QMetaType::Type that best represents the values of \p column,
+     * the default implementation uses the type of the first non null value.
+     */
+    virtual int columnType(int column) const;
+
+    /*!
+     * \brief rawValue returns the bytes used by \sa AResult::contentHash(), the default implementation
+     * converts value() to text, drivers can return the data they received without copying it.
+     */
+    virtual QByteArray rawValue(int row, int column) const;
 };
 
 class ASQL_EXPORT AResult
@@ -73,6 +93,12 @@ public:
      */
     QStringList columnNames() const;
 
+    /*!
+     * \brief columnType returns the QMetaType::Type that best represents the values of \p column
+     * \return
+     */
+    int columnType(int column) const;
+
     /*!
      * \brief hash returns the first row as a QHash object
      * \return
@@ -97,6 +123,41 @@ public:
      */
     QJsonArray toJsonArray() const;
 
+    /*!
+     * \brief toCbor writes all rows as a CBOR map with a "columns" array holding the column names
+     * and a "rows" array where each row is an array of typed values.
+     *
+     * This is much more compact and cheaper to produce than \sa toJsonArray(), integers are
+     * encoded as integers, timestamps as tagged date time strings and bytea as byte strings.
+     * \param writer
+     */
+    void toCbor(QCborStreamWriter &writer) const;
+
+    /*!
+     * \brief toCbor returns all rows encoded as CBOR, \sa toCbor(QCborStreamWriter &)
+     * \return
+     */
+    QByteArray toCbor() const;
+
+    /*!
+     * \brief toCborRows writes each row as a CBOR array of values without any enclosing container
+     *
+     * This allows for streaming rows received in single row mode, inside an indefinite length
+     * array started by the caller.
+     * \param writer
+     */
+    void toCborRows(QCborStreamWriter &writer) const;
+
+    /*!
+     * \brief contentHash returns a fast non-cryptographic hash (XXH64) of the column names and values
+     *
+     * The values are hashed as the driver received them, without conversion, so this is
+     * much cheaper than serializing the result, useful as an HTTP ETag or to detect if a
+     * refreshed result actually changed.
+     * \return
+     */
+    quint64 contentHash() const;
+
     AResult &operator=(const AResult &copy);
     bool operator==(const AResult &other) const;
 
@@ -124,6 +185,7 @@ public:
         QDateTime toDateTime() const;
         QJsonValue toJsonValue() const;
         inline QByteArray toByteArray() const  { return d->toByteArray(row, column); }
+        inline void toCbor(QCborStreamWriter &writer) const  { d->toCbor(writer, row, column); }
     };
 
     class ASQL_EXPORT ARow {
@@ -151,6 +213,12 @@ public:
          */
         QJsonObject toJsonObject() const;
 
+        /*!
+         * \brief toCbor writes the row as a CBOR array of values
+         * \param writer
+         */
+        void toCbor(QCborStreamWriter &writer) const;
+
         inline int at() const { return row; }
         inline QVariant value(int column) const { return d->value(row, column); }
         inline QVariant value(const QString &name) const { return d->value(row, d->indexOfField(name)); }
@@ -0,0 +1,220 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aresultmodel.h"
+
+#include "aresult.h"
+
+#include <QAtomicInt>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(ASQL_MODEL, "asql.resultmodel", QtInfoMsg)
+
+namespace ASql {
+
+struct AResultBatch {
+    AResult result;
+    int firstRow;
+};
+
+class AResultModelPrivate
+{
+public:
+    void finish();
+
+    ADatabase db;
+    QString cursor;
+    QString errorString;
+    QStringList columnNames;
+    std::vector<AResultBatch> batches;
+    std::shared_ptr<QObject> cancellable;
+    int rows = 0;
+    int fetchSize = 256;
+    bool fetching = false;
+    bool atEnd = true;
+};
+
+}
+
+using namespace ASql;
+
+static QAtomicInt cursorCounter;
+
+void AResultModelPrivate::finish()
+{
+    if (!cursor.isEmpty() && db.isValid()) {
+        // closes the cursor as well
+        db.commit();
+    }
+    cursor.clear();
+    db = ADatabase();
+    atEnd = true;
+    fetching = false;
+}
+
+AResultModel::AResultModel(QObject *parent) : QAbstractTableModel(parent)
+  , d_ptr(new AResultModelPrivate)
+{
+}
+
+AResultModel::~AResultModel()
+{
+    Q_D(AResultModel);
+    d->finish();
+    delete d_ptr;
+}
+
+void AResultModel::setQuery(const ADatabase &db, const QString &query, const QVariantList &params, int fetchSize)
+{
+    Q_D(AResultModel);
+    clear();
+
+    d->db = db;
+    d->fetchSize = qMax(1, fetchSize);
+    d->cursor = QLatin1String("asql_model_") + QString::number(cursorCounter.fetchAndAddRelaxed(1));
+    d->atEnd = false;
+    d->cancellable = std::make_shared<QObject>();
+
+    d->db.begin();
+    const QString declare = QLatin1String("DECLARE ") + d->cursor + QLatin1String(" NO SCROLL CURSOR FOR ") + query;
+    d->db.exec(declare, params, [this] (AResult &result) {
+        Q_D(AResultModel);
+        if (result.error()) {
+            qCWarning(ASQL_MODEL) << "Failed to declare cursor" << result.errorString();
+            d->errorString = result.errorString();
+            d->db.rollback();
+            d->cursor.clear();
+            d->finish();
+            Q_EMIT errorOccurred(d->errorString);
+        }
+    }, d->cancellable.get());
+
+    fetchMore(QModelIndex());
+}
+
+void AResultModel::clear()
+{
+    Q_D(AResultModel);
+    beginResetModel();
+    // results of queries still in flight are ignored
+    d->cancellable.reset();
+    d->finish();
+    d->batches.clear();
+    d->columnNames.clear();
+    d->errorString.clear();
+    d->rows = 0;
+    endResetModel();
+}
+
+bool AResultModel::isFetching() const
+{
+    Q_D(const AResultModel);
+    return d->fetching;
+}
+
+bool AResultModel::atEnd() const
+{
+    Q_D(const AResultModel);
+    return d->atEnd;
+}
+
+QString AResultModel::errorString() const
+{
+    Q_D(const AResultModel);
+    return d->errorString;
+}
+
+int AResultModel::rowCount(const QModelIndex &parent) const
+{
+    Q_D(const AResultModel);
+    return parent.isValid() ? 0 : d->rows;
+}
+
+int AResultModel::columnCount(const QModelIndex &parent) const
+{
+    Q_D(const AResultModel);
+    return parent.isValid() ? 0 : d->columnNames.size();
+}
+
+QVariant AResultModel::data(const QModelIndex &index, int role) const
+{
+    Q_D(const AResultModel);
+    if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole) || index.row() >= d->rows) {
+        return {};
+    }
+
+    // last batch starting at or before the row
+    auto it = std::upper_bound(d->batches.cbegin(), d->batches.cend(), index.row(), [] (int row, const AResultBatch &batch) {
+        return row < batch.firstRow;
+    });
+    --it;
+    return it->result[index.row() - it->firstRow].value(index.column());
+}
+
+QVariant AResultModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    Q_D(const AResultModel);
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+        return d->columnNames.value(section);
+    }
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+bool AResultModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const AResultModel);
+    return !parent.isValid() && !d->atEnd && !d->fetching;
+}
+
+void AResultModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(AResultModel);
+    if (parent.isValid() || d->atEnd || d->fetching) {
+        return;
+    }
+
+    d->fetching = true;
+    const QString fetch = QLatin1String("FETCH ") + QString::number(d->fetchSize) + QLatin1String(" FROM ") + d->cursor;
+    d->db.exec(fetch, [this] (AResult &result) {
+        Q_D(AResultModel);
+        d->fetching = false;
+        if (result.error()) {
+            if (d->errorString.isEmpty()) {
+                // otherwise the DECLARE failure was already reported
+                qCWarning(ASQL_MODEL) << "Failed to fetch rows" << d->cursor << result.errorString();
+                d->errorString = result.errorString();
+                d->db.rollback();
+                d->cursor.clear();
+                d->finish();
+                Q_EMIT errorOccurred(d->errorString);
+            }
+            return;
+        }
+
+        const QStringList columnNames = d->columnNames.isEmpty() ? result.columnNames() : QStringList();
+        if (!columnNames.isEmpty()) {
+            beginInsertColumns(QModelIndex(), 0, columnNames.size() - 1);
+            d->columnNames = columnNames;
+            endInsertColumns();
+        }
+
+        const int size = result.size();
+        if (size) {
+            beginInsertRows(QModelIndex(), d->rows, d->rows + size - 1);
+            d->batches.push_back({result, d->rows});
+            d->rows += size;
+            endInsertRows();
+        }
+
+        qCDebug(ASQL_MODEL) << "fetched" << size << "rows" << d->cursor << d->rows;
+        if (size < d->fetchSize) {
+            d->finish();
+        }
+    }, d->cancellable.get());
+}
+
+#include "moc_aresultmodel.cpp"
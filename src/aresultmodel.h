@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ARESULTMODEL_H
+#define ARESULTMODEL_H
+
+#include <QAbstractTableModel>
+
+#include <adatabase.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+class AResultModelPrivate;
+
+/*!
+ * \brief The AResultModel class exposes the rows of a query as a table model
+ *
+ * Rows are fetched on demand through a server side cursor, views call canFetchMore()
+ * and fetchMore() as they scroll, so only the rows that were reached are transferred.
+ * Batches are kept as returned by the driver and cells are only converted to QVariant
+ * when data() is called for them.
+ *
+ * A cursor only lives inside a transaction, which stays open until all rows were
+ * fetched or the model is cleared, so the model needs a dedicated connection.
+ *
+ * \code{.cpp}
+ * auto model = new AResultModel(this);
+ * model->setQuery(db, QStringLiteral("SELECT * FROM audit_log ORDER BY id"));
+ * view->setModel(model);
+ * \endcode
+ */
+class ASQL_EXPORT AResultModel : public QAbstractTableModel
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(AResultModel)
+public:
+    explicit AResultModel(QObject *parent = nullptr);
+    virtual ~AResultModel();
+
+    /*!
+     * \brief setQuery declares a cursor for \p query and fetches the first \p fetchSize rows
+     * \param db a connection that isn't shared while the model is fetching
+     * \param query
+     * \param params
+     * \param fetchSize number of rows fetched each time fetchMore() is called
+     */
+    void setQuery(const ADatabase &db, const QString &query, const QVariantList &params = {}, int fetchSize = 256);
+
+    /*!
+     * \brief clear removes all rows, closes the cursor and finishes its transaction
+     */
+    void clear();
+
+    /*!
+     * \brief isFetching returns true while a batch of rows is being fetched
+     */
+    bool isFetching() const;
+
+    /*!
+     * \brief atEnd returns true once all rows of the query were fetched
+     */
+    bool atEnd() const;
+
+    QString errorString() const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+Q_SIGNALS:
+    /*!
+     * \brief errorOccurred is emitted when declaring the cursor or fetching rows fails
+     */
+    void errorOccurred(const QString &errorString);
+
+private:
+    AResultModelPrivate *d_ptr;
+};
+
+}
+
+#endif // ARESULTMODEL_H
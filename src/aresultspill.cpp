@@ -0,0 +1,410 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aresultspill.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QUuid>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY(ASQL_SPILL, "asql.spill", QtInfoMsg)
+
+using namespace ASql;
+
+/*
+ * Each row is written as one qint32 length per column, -1 for NULL,
+ * followed by the column data. Every non NULL cell starts with the
+ * qint32 QMetaType id of the value, so that it is restored with the
+ * same type it was appended with, followed by the value in a text
+ * form, except for byte arrays that are stored as is.
+ */
+static QByteArray serialize(const QVariant &value, int type)
+{
+    switch (type) {
+    case QMetaType::Bool:
+        return value.toBool() ? QByteArrayLiteral("t") : QByteArrayLiteral("f");
+    case QMetaType::Int:
+    case QMetaType::LongLong:
+        return QByteArray::number(value.toLongLong());
+    case QMetaType::UInt:
+    case QMetaType::ULongLong:
+        return QByteArray::number(value.toULongLong());
+    case QMetaType::Double:
+        return QByteArray::number(value.toDouble(), 'g', 17);
+    case QMetaType::QDate:
+        return value.toDate().toString(Qt::ISODate).toLatin1();
+    case QMetaType::QTime:
+        return value.toTime().toString(Qt::ISODateWithMs).toLatin1();
+    case QMetaType::QDateTime:
+        return value.toDateTime().toString(Qt::ISODateWithMs).toLatin1();
+    case QMetaType::QByteArray:
+        return value.toByteArray();
+    case QMetaType::QUuid:
+        return value.toUuid().toByteArray();
+    case QMetaType::QJsonValue:
+        // Wrapped in an array so that scalars are also valid documents
+        return QJsonDocument(QJsonArray{value.toJsonValue()}).toJson(QJsonDocument::Compact);
+    case QMetaType::QJsonObject:
+        return QJsonDocument(value.toJsonObject()).toJson(QJsonDocument::Compact);
+    case QMetaType::QJsonArray:
+        return QJsonDocument(value.toJsonArray()).toJson(QJsonDocument::Compact);
+    case QMetaType::QJsonDocument:
+        return value.toJsonDocument().toJson(QJsonDocument::Compact);
+    default:
+        return value.toString().toUtf8();
+    }
+}
+
+AResultSpill::AResultSpill(const QString &fileTemplate)
+{
+    if (!fileTemplate.isEmpty()) {
+        m_file.setFileTemplate(fileTemplate);
+    } else {
+        m_file.setFileTemplate(QDir::tempPath() + QLatin1String("/asql_spill_XXXXXX"));
+    }
+
+    if (!m_file.open()) {
+        setError(QLatin1String("Failed to open spill file: ") + m_file.errorString());
+    }
+}
+
+AResultSpill::~AResultSpill()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+    }
+}
+
+bool AResultSpill::append(const AResult &result)
+{
+    if (m_error) {
+        return false;
+    }
+
+    if (result.error()) {
+        setError(result.errorString());
+        return false;
+    }
+
+    if (m_map) {
+        setError(QStringLiteral("Can not append rows to a finished spill file"));
+        return false;
+    }
+
+    if (m_fieldNames.isEmpty()) {
+        m_fieldNames = result.columnNames();
+    }
+
+    const int columns = m_fieldNames.size();
+    if (result.size() && result.fields() != columns) {
+        setError(QStringLiteral("Appended result has %1 columns, expected %2").arg(result.fields()).arg(columns));
+        return false;
+    }
+
+    QByteArray row;
+    QVector<qint32> lengths(columns);
+    for (const auto &sourceRow : result) {
+        row.clear();
+        row.resize(columns * int(sizeof(qint32)));
+        for (int i = 0; i < columns; ++i) {
+            const QVariant value = sourceRow.value(i);
+            if (value.isNull()) {
+                lengths[i] = -1;
+                continue;
+            }
+
+            const qint32 type = value.userType();
+            const QByteArray data = serialize(value, type);
+            lengths[i] = data.size();
+            row.append(reinterpret_cast<const char *>(&type), sizeof(qint32));
+            row.append(data);
+        }
+        memcpy(row.data(), lengths.constData(), columns * sizeof(qint32));
+
+        m_rowOffsets.append(m_size);
+        if (m_file.write(row) != row.size()) {
+            setError(QLatin1String("Failed to write spill file: ") + m_file.errorString());
+            return false;
+        }
+        m_size += row.size();
+    }
+
+    return true;
+}
+
+bool AResultSpill::finish()
+{
+    if (m_error) {
+        return false;
+    }
+
+    if (m_map || m_size == 0) {
+        return true;
+    }
+
+    if (!m_file.flush()) {
+        setError(QLatin1String("Failed to flush spill file: ") + m_file.errorString());
+        return false;
+    }
+
+    m_map = m_file.map(0, m_size);
+    if (!m_map) {
+        setError(QLatin1String("Failed to map spill file: ") + m_file.errorString());
+        return false;
+    }
+
+    qDebug(ASQL_SPILL) << "Spilled" << m_rowOffsets.size() << "rows" << m_size << "bytes into" << m_file.fileName();
+    return true;
+}
+
+AResultFn AResultSpill::collect(AResultFn cb, const QString &fileTemplate)
+{
+    auto spill = std::make_shared<AResultSpill>(fileTemplate);
+    return [spill, cb] (AResult &result) {
+        if (result.error()) {
+            cb(result);
+            return;
+        }
+
+        spill->append(result);
+        if (result.lastResulSet()) {
+            spill->finish();
+            AResult spilled(spill);
+            cb(spilled);
+        }
+    };
+}
+
+bool AResultSpill::lastResulSet() const
+{
+    return true;
+}
+
+bool AResultSpill::error() const
+{
+    return m_error;
+}
+
+QString AResultSpill::errorString() const
+{
+    return m_errorString;
+}
+
+int AResultSpill::size() const
+{
+    return m_map ? m_rowOffsets.size() : 0;
+}
+
+int AResultSpill::fields() const
+{
+    return m_fieldNames.size();
+}
+
+int AResultSpill::numRowsAffected() const
+{
+    return size();
+}
+
+QString AResultSpill::fieldName(int column) const
+{
+    return m_fieldNames.value(column);
+}
+
+QVariant AResultSpill::value(int row, int column) const
+{
+    bool null;
+    int type;
+    const QByteArray data = cell(row, column, &null, &type);
+    if (null) {
+        return {};
+    }
+
+    switch (type) {
+    case QMetaType::Bool:
+        return data == "t";
+    case QMetaType::Int:
+        return data.toInt();
+    case QMetaType::LongLong:
+        return data.toLongLong();
+    case QMetaType::UInt:
+        return data.toUInt();
+    case QMetaType::ULongLong:
+        return data.toULongLong();
+    case QMetaType::Double:
+        return data.toDouble();
+    case QMetaType::QDate:
+        return toDate(row, column);
+    case QMetaType::QTime:
+        return toTime(row, column);
+    case QMetaType::QDateTime:
+        return toDateTime(row, column);
+    case QMetaType::QByteArray:
+        return QByteArray(data.constData(), data.size());
+    case QMetaType::QUuid:
+        return QUuid(data);
+    case QMetaType::QJsonValue:
+        return toJsonValue(row, column);
+    case QMetaType::QJsonObject:
+        return QJsonDocument::fromJson(data).object();
+    case QMetaType::QJsonArray:
+        return QJsonDocument::fromJson(data).array();
+    case QMetaType::QJsonDocument:
+        return QJsonDocument::fromJson(data);
+    default:
+        return QString::fromUtf8(data);
+    }
+}
+
+bool AResultSpill::isNull(int row, int column) const
+{
+    bool null;
+    cell(row, column, &null);
+    return null;
+}
+
+bool AResultSpill::toBool(int row, int column) const
+{
+    return cell(row, column) == "t";
+}
+
+int AResultSpill::toInt(int row, int column) const
+{
+    return cell(row, column).toInt();
+}
+
+qint64 AResultSpill::toLongLong(int row, int column) const
+{
+    return cell(row, column).toLongLong();
+}
+
+quint64 AResultSpill::toULongLong(int row, int column) const
+{
+    return cell(row, column).toULongLong();
+}
+
+double AResultSpill::toDouble(int row, int column) const
+{
+    return cell(row, column).toDouble();
+}
+
+QString AResultSpill::toString(int row, int column) const
+{
+    return QString::fromUtf8(cell(row, column));
+}
+
+std::string AResultSpill::toStdString(int row, int column) const
+{
+    const QByteArray data = cell(row, column);
+    return std::string(data.constData(), size_t(data.size()));
+}
+
+QDate AResultSpill::toDate(int row, int column) const
+{
+    return QDate::fromString(QString::fromLatin1(cell(row, column)), Qt::ISODate);
+}
+
+QTime AResultSpill::toTime(int row, int column) const
+{
+    return QTime::fromString(QString::fromLatin1(cell(row, column)), Qt::ISODateWithMs);
+}
+
+QDateTime AResultSpill::toDateTime(int row, int column) const
+{
+    return QDateTime::fromString(QString::fromLatin1(cell(row, column)), Qt::ISODateWithMs);
+}
+
+QJsonValue AResultSpill::toJsonValue(int row, int column) const
+{
+    bool null;
+    int type;
+    const QByteArray data = cell(row, column, &null, &type);
+    if (null) {
+        return {};
+    }
+
+    switch (type) {
+    case QMetaType::QJsonValue:
+        return QJsonDocument::fromJson(data).array().at(0);
+    case QMetaType::QJsonObject:
+    case QMetaType::QJsonArray:
+    case QMetaType::QJsonDocument:
+    {
+        const auto doc = QJsonDocument::fromJson(data);
+        if (doc.isObject()) {
+            return doc.object();
+        } else if (doc.isArray()) {
+            return doc.array();
+        }
+        return {};
+    }
+    default:
+        return QJsonValue::fromVariant(value(row, column));
+    }
+}
+
+QByteArray AResultSpill::toByteArray(int row, int column) const
+{
+    const QByteArray data = cell(row, column);
+    return QByteArray(data.constData(), data.size());
+}
+
+/*!
+ * Returns the raw column data pointing to the mapped file,
+ * it must not outlive this object. \a type is set to the
+ * QMetaType id the value was appended with.
+ */
+QByteArray AResultSpill::cell(int row, int column, bool *isNull, int *type) const
+{
+    Q_ASSERT_X(m_map, "cell", "spill file not finished");
+    Q_ASSERT_X(row >= 0 && row < m_rowOffsets.size(), "cell", "row out of range");
+    Q_ASSERT_X(column >= 0 && column < m_fieldNames.size(), "cell", "column out of range");
+
+    const uchar *rowData = m_map + m_rowOffsets[row];
+    const int columns = m_fieldNames.size();
+
+    qint32 length;
+    qint64 offset = columns * qint64(sizeof(qint32));
+    for (int i = 0; i < column; ++i) {
+        memcpy(&length, rowData + i * sizeof(qint32), sizeof(qint32));
+        if (length >= 0) {
+            offset += qint64(sizeof(qint32)) + length;
+        }
+    }
+    memcpy(&length, rowData + column * sizeof(qint32), sizeof(qint32));
+
+    if (isNull) {
+        *isNull = length == -1;
+    }
+    if (type) {
+        *type = QMetaType::UnknownType;
+    }
+    if (length == -1) {
+        return {};
+    }
+
+    if (type) {
+        qint32 cellType;
+        memcpy(&cellType, rowData + offset, sizeof(qint32));
+        *type = cellType;
+    }
+    if (length == 0) {
+        // empty but not null, like the value of an empty string column
+        return QByteArray("");
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(rowData + offset + sizeof(qint32)), length);
+}
+
+void AResultSpill::setError(const QString &error)
+{
+    qWarning(ASQL_SPILL) << error;
+    m_error = true;
+    m_errorString = error;
+}
@@ -0,0 +1,110 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ARESULTSPILL_H
+#define ARESULTSPILL_H
+
+#include <QTemporaryFile>
+#include <QVector>
+
+#include <aresult.h>
+#include <adatabase.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+/*!
+ * \brief The AResultSpill class is an AResult backend stored on a memory-mapped temporary file
+ *
+ * Rows streamed in single row mode are appended to a temporary file using a compact
+ * row format, once finished the file is memory-mapped and the usual AResult API can
+ * be used to access the rows in any order, without holding the whole result in memory.
+ *
+ * \code{.cpp}
+ * db.exec(u"SELECT * FROM huge_table", AResultSpill::collect([] (AResult &result) {
+ *     for (auto row : result) {
+ *         // ...
+ *     }
+ * }));
+ * db.setLastQuerySingleRowMode();
+ * \endcode
+ */
+class ASQL_EXPORT AResultSpill final : public AResultPrivate
+{
+public:
+    /*!
+     * \brief AResultSpill constructs a new spill result
+     * \param fileTemplate temporary file template, see QTemporaryFile, defaults to the system temporary directory
+     */
+    explicit AResultSpill(const QString &fileTemplate = QString());
+    virtual ~AResultSpill();
+
+    /*!
+     * \brief append copies all rows of \p result into the file, the first appended result defines the columns
+     * \param result
+     * \return false on error
+     */
+    bool append(const AResult &result);
+
+    /*!
+     * \brief finish flushes and maps the file, rows can only be accessed after this call
+     * \return false on error
+     */
+    bool finish();
+
+    /*!
+     * \brief collect returns a callback that spills every row it receives, once the last
+     * result set arrives \p cb is called with a single AResult containing all rows.
+     *
+     * Errors are delivered to \p cb as they arrive.
+     *
+     * \param cb
+     * \param fileTemplate
+     * \return
+     */
+    static AResultFn collect(AResultFn cb, const QString &fileTemplate = QString());
+
+    bool lastResulSet() const override;
+    bool error() const override;
+    QString errorString() const override;
+
+    int size() const override;
+    int fields() const override;
+    int numRowsAffected() const override;
+
+    QString fieldName(int column) const override;
+    QVariant value(int row, int column) const override;
+
+    bool isNull(int row, int column) const override;
+    bool toBool(int row, int column) const override;
+    int toInt(int row, int column) const override;
+    qint64 toLongLong(int row, int column) const override;
+    quint64 toULongLong(int row, int column) const override;
+    double toDouble(int row, int column) const override;
+    QString toString(int row, int column) const override;
+    std::string toStdString(int row, int column) const override;
+    QDate toDate(int row, int column) const override;
+    QTime toTime(int row, int column) const override;
+    QDateTime toDateTime(int row, int column) const override;
+    QJsonValue toJsonValue(int row, int column) const override;
+    QByteArray toByteArray(int row, int column) const override;
+
+private:
+    QByteArray cell(int row, int column, bool *isNull = nullptr, int *type = nullptr) const;
+    void setError(const QString &error);
+
+    QTemporaryFile m_file;
+    QStringList m_fieldNames;
+    QVector<qint64> m_rowOffsets;
+    QString m_errorString;
+    uchar *m_map = nullptr;
+    qint64 m_size = 0;
+    bool m_error = false;
+};
+
+}
+
+#endif // ARESULTSPILL_H
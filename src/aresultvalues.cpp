@@ -0,0 +1,176 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "aresultvalues.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+using namespace ASql;
+
+AResultValues::AResultValues(const QStringList &fieldNames, const QVector<QVariantList> &rows, const QVector<int> &types)
+    : m_fieldNames(fieldNames)
+    , m_rows(rows)
+    , m_types(types)
+{
+}
+
+AResultValues::~AResultValues() = default;
+
+void AResultValues::appendRow(const QVariantList &row)
+{
+    Q_ASSERT_X(row.size() == m_fieldNames.size(), "appendRow", "wrong number of columns");
+    m_rows.append(row);
+}
+
+QVector<QVariantList> AResultValues::rows() const
+{
+    return m_rows;
+}
+
+void AResultValues::setError(const QString &error)
+{
+    m_error = true;
+    m_errorString = error;
+}
+
+void AResultValues::setLastResultSet(bool lastResultSet)
+{
+    m_lastResultSet = lastResultSet;
+}
+
+void AResultValues::setNumRowsAffected(int rows)
+{
+    m_numRowsAffected = rows;
+}
+
+bool AResultValues::lastResulSet() const
+{
+    return m_lastResultSet;
+}
+
+bool AResultValues::error() const
+{
+    return m_error;
+}
+
+QString AResultValues::errorString() const
+{
+    return m_errorString;
+}
+
+int AResultValues::size() const
+{
+    return m_rows.size();
+}
+
+int AResultValues::fields() const
+{
+    return m_fieldNames.size();
+}
+
+int AResultValues::numRowsAffected() const
+{
+    if (m_numRowsAffected != -1) {
+        return m_numRowsAffected;
+    }
+    return m_rows.size();
+}
+
+QString AResultValues::fieldName(int column) const
+{
+    return m_fieldNames.value(column);
+}
+
+QVariant AResultValues::value(int row, int column) const
+{
+    return m_rows[row].value(column);
+}
+
+bool AResultValues::isNull(int row, int column) const
+{
+    return m_rows[row].value(column).isNull();
+}
+
+bool AResultValues::toBool(int row, int column) const
+{
+    return m_rows[row].value(column).toBool();
+}
+
+int AResultValues::toInt(int row, int column) const
+{
+    return m_rows[row].value(column).toInt();
+}
+
+qint64 AResultValues::toLongLong(int row, int column) const
+{
+    return m_rows[row].value(column).toLongLong();
+}
+
+quint64 AResultValues::toULongLong(int row, int column) const
+{
+    return m_rows[row].value(column).toULongLong();
+}
+
+double AResultValues::toDouble(int row, int column) const
+{
+    return m_rows[row].value(column).toDouble();
+}
+
+QString AResultValues::toString(int row, int column) const
+{
+    return m_rows[row].value(column).toString();
+}
+
+std::string AResultValues::toStdString(int row, int column) const
+{
+    return m_rows[row].value(column).toString().toStdString();
+}
+
+QDate AResultValues::toDate(int row, int column) const
+{
+    return m_rows[row].value(column).toDate();
+}
+
+QTime AResultValues::toTime(int row, int column) const
+{
+    return m_rows[row].value(column).toTime();
+}
+
+QDateTime AResultValues::toDateTime(int row, int column) const
+{
+    return m_rows[row].value(column).toDateTime();
+}
+
+QJsonValue AResultValues::toJsonValue(int row, int column) const
+{
+    const QVariant data = m_rows[row].value(column);
+    if (data.userType() == QMetaType::QString || data.userType() == QMetaType::QByteArray) {
+        QJsonValue ret;
+        const auto doc = QJsonDocument::fromJson(data.toByteArray());
+        if (doc.isObject()) {
+            ret = doc.object();
+        } else if (doc.isArray()) {
+            ret = doc.array();
+        }
+        return ret;
+    }
+    return QJsonValue::fromVariant(data);
+}
+
+QByteArray AResultValues::toByteArray(int row, int column) const
+{
+    return m_rows[row].value(column).toByteArray();
+}
+
+int AResultValues::columnType(int column) const
+{
+    if (column < m_types.size()) {
+        return m_types[column];
+    }
+    return AResultPrivate::columnType(column);
+}
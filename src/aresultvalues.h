@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ARESULTVALUES_H
+#define ARESULTVALUES_H
+
+#include <QStringList>
+#include <QVector>
+
+#include <aresult.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+/*!
+ * \brief The AResultValues class is an AResult backend holding rows of QVariant values
+ *
+ * It's useful for data that doesn't come from a driver result, like rows decoded
+ * from other formats or assembled from several results.
+ */
+class ASQL_EXPORT AResultValues final : public AResultPrivate
+{
+public:
+    /*!
+     * \brief AResultValues constructs a new result
+     * \param fieldNames the column names
+     * \param rows each row must have one value per column
+     * \param types optional QMetaType::Type of each column, \sa columnType()
+     */
+    explicit AResultValues(const QStringList &fieldNames, const QVector<QVariantList> &rows = {}, const QVector<int> &types = {});
+    virtual ~AResultValues();
+
+    void appendRow(const QVariantList &row);
+    QVector<QVariantList> rows() const;
+
+    void setError(const QString &error);
+    void setLastResultSet(bool lastResultSet);
+
+    /*!
+     * \brief setNumRowsAffected overrides numRowsAffected(), which defaults to the number of rows
+     */
+    void setNumRowsAffected(int rows);
+
+    bool lastResulSet() const override;
+    bool error() const override;
+    QString errorString() const override;
+
+    int size() const override;
+    int fields() const override;
+    int numRowsAffected() const override;
+
+    QString fieldName(int column) const override;
+    QVariant value(int row, int column) const override;
+
+    bool isNull(int row, int column) const override;
+    bool toBool(int row, int column) const override;
+    int toInt(int row, int column) const override;
+    qint64 toLongLong(int row, int column) const override;
+    quint64 toULongLong(int row, int column) const override;
+    double toDouble(int row, int column) const override;
+    QString toString(int row, int column) const override;
+    std::string toStdString(int row, int column) const override;
+    QDate toDate(int row, int column) const override;
+    QTime toTime(int row, int column) const override;
+    QDateTime toDateTime(int row, int column) const override;
+    QJsonValue toJsonValue(int row, int column) const override;
+    QByteArray toByteArray(int row, int column) const override;
+    int columnType(int column) const override;
+
+private:
+    QStringList m_fieldNames;
+    QVector<QVariantList> m_rows;
+    QVector<int> m_types;
+    QString m_errorString;
+    int m_numRowsAffected = -1;
+    bool m_error = false;
+    bool m_lastResultSet = true;
+};
+
+}
+
+#endif // ARESULTVALUES_H
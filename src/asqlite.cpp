@@ -0,0 +1,81 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+#include "asqlite.h"
+#include "adriversqlite.h"
+
+using namespace ASql;
+
+namespace ASql {
+
+class ASqlitePrivate
+{
+public:
+    QString connection;
+    int statementCacheSize = 64;
+};
+
+}
+
+ASqlite::ASqlite(const QString &connectionInfo)
+    : d(new ASqlitePrivate)
+{
+    d->connection = connectionInfo;
+}
+
+ASqlite::~ASqlite()
+{
+    delete d;
+}
+
+std::shared_ptr<ADriverFactory> ASqlite::factory(const QUrl &connectionInfo)
+{
+    return ASqlite::factory(connectionInfo.toString(QUrl::None));
+}
+
+std::shared_ptr<ADriverFactory> ASqlite::factory(const QString &connectionInfo)
+{
+    auto ret = std::make_shared<ASqlite>(connectionInfo);
+    return ret;
+}
+
+std::shared_ptr<ADriverFactory> ASqlite::factory(QStringView connectionInfo)
+{
+    return ASqlite::factory(connectionInfo.toString());
+}
+
+ADatabase ASqlite::database(const QString &connectionInfo)
+{
+    ADatabase ret(std::make_shared<ASqlite>(connectionInfo));
+    return ret;
+}
+
+void ASqlite::setStatementCacheSize(int size)
+{
+    d->statementCacheSize = qMax(0, size);
+}
+
+int ASqlite::statementCacheSize() const
+{
+    return d->statementCacheSize;
+}
+
+ADriver *ASqlite::createRawDriver() const
+{
+    auto ret = new ADriverSqlite(d->connection, d->statementCacheSize);
+    ret->setConnectionLimiter(connectionLimiter());
+    return ret;
+}
+
+std::shared_ptr<ADriver> ASqlite::createDriver() const
+{
+    auto ret = std::make_shared<ADriverSqlite>(d->connection, d->statementCacheSize);
+    ret->setConnectionLimiter(connectionLimiter());
+    return ret;
+}
+
+ADatabase ASqlite::createDatabase() const
+{
+    return ADatabase(createDriver());
+}
@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef ASQLITE_H
+#define ASQLITE_H
+
+#include "adriverfactory.h"
+
+#include <asqlexports.h>
+
+#include <QUrl>
+
+namespace ASql {
+
+class ASqlitePrivate;
+class ASQL_SQLITE_EXPORT ASqlite : public ADriverFactory
+{
+public:
+    /*!
+     * \brief ASqlite contructs an driver factory for a SQLite database
+     *
+     * Each connection runs its queries on its own worker thread, callbacks are
+     * called on the thread that owns the connection, so it behaves like the
+     * PostgreSQL driver for code written against ADatabase.
+     *
+     * Examples of connection info:
+     * * A file "/var/cache/app/cache.db"
+     * * A file using a URL "sqlite:///var/cache/app/cache.db"
+     * * A private in memory database ":memory:"
+     * * A SQLite URI "file:cache.db?mode=ro"
+     */
+    ASqlite(const QString &connectionInfo);
+    ~ASqlite();
+
+    static std::shared_ptr<ADriverFactory> factory(const QUrl &connectionInfo);
+    static std::shared_ptr<ADriverFactory> factory(const QString &connectionInfo);
+    static std::shared_ptr<ADriverFactory> factory(QStringView connectionInfo);
+    static ADatabase database(const QString &connectionInfo);
+
+    /*!
+     * \brief setStatementCacheSize sets how many prepared statements each connection keeps,
+     * the default is 64, 0 disables the cache
+     */
+    void setStatementCacheSize(int size);
+    int statementCacheSize() const;
+
+    ADriver *createRawDriver() const final;
+    std::shared_ptr<ADriver> createDriver() const final;
+    ADatabase createDatabase() const final;
+
+private:
+    ASqlitePrivate *d;
+};
+
+}
+
+#endif // ASQLITE_H
@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "astallmonitor.h"
+
+#include <QDateTime>
+#include <QMutex>
+#include <QObject>
+#include <QLoggingCategory>
+
+#include <algorithm>
+#include <atomic>
+
+Q_LOGGING_CATEGORY(ASQL_STALL, "asql.stall", QtInfoMsg)
+
+using namespace ASql;
+
+namespace {
+
+std::atomic<bool> m_enabled{false};
+std::atomic<qint64> m_warningThresholdUs{20000};
+
+struct AStallMonitorData {
+    QMutex mutex;
+    QVector<AStallRecord> records;
+    int maxRecords = 20;
+};
+
+AStallMonitorData *monitorData()
+{
+    static AStallMonitorData data;
+    return &data;
+}
+
+}
+
+void AStallMonitor::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool AStallMonitor::isEnabled()
+{
+    return m_enabled.load(std::memory_order_relaxed);
+}
+
+void AStallMonitor::setWarningThreshold(qint64 usecs)
+{
+    m_warningThresholdUs.store(usecs, std::memory_order_relaxed);
+}
+
+qint64 AStallMonitor::warningThreshold()
+{
+    return m_warningThresholdUs.load(std::memory_order_relaxed);
+}
+
+void AStallMonitor::setMaxRecords(int max)
+{
+    auto data = monitorData();
+    QMutexLocker locker(&data->mutex);
+    data->maxRecords = qMax(0, max);
+    if (data->records.size() > data->maxRecords) {
+        data->records.resize(data->maxRecords);
+    }
+}
+
+QVector<AStallRecord> AStallMonitor::worstOffenders()
+{
+    auto data = monitorData();
+    QMutexLocker locker(&data->mutex);
+    return data->records;
+}
+
+void AStallMonitor::reset()
+{
+    auto data = monitorData();
+    QMutexLocker locker(&data->mutex);
+    data->records.clear();
+}
+
+void AStallMonitor::record(const QByteArray &query, const QString &tag, qint64 elapsedNs)
+{
+    const qint64 elapsedUs = elapsedNs / 1000;
+    if (elapsedUs > warningThreshold()) {
+        qWarning(ASQL_STALL).nospace() << "Callback blocked the event loop for " << elapsedUs << "us, tag: "
+                                       << tag << " query: " << query;
+    }
+
+    auto data = monitorData();
+    QMutexLocker locker(&data->mutex);
+    auto &records = data->records;
+    if (records.size() >= data->maxRecords && (records.isEmpty() || records.last().elapsedUs >= elapsedUs)) {
+        return;
+    }
+
+    AStallRecord record;
+    record.query = QString::fromUtf8(query);
+    record.tag = tag;
+    record.elapsedUs = elapsedUs;
+    record.timestamp = QDateTime::currentMSecsSinceEpoch();
+
+    // records are kept sorted, slowest first
+    auto it = std::upper_bound(records.begin(), records.end(), elapsedUs, [] (qint64 value, const AStallRecord &r) {
+        return value > r.elapsedUs;
+    });
+    records.insert(it, record);
+    if (records.size() > data->maxRecords) {
+        records.removeLast();
+    }
+}
+
+QString AStallMonitor::receiverTag(const QObject *receiver)
+{
+    if (!receiver) {
+        return QStringLiteral("(no receiver)");
+    }
+
+    QString ret = QString::fromLatin1(receiver->metaObject()->className());
+    const QString name = receiver->objectName();
+    if (!name.isEmpty()) {
+        ret += QLatin1Char('/') + name;
+    }
+    return ret;
+}
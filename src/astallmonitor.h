@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ASTALLMONITOR_H
+#define ASTALLMONITOR_H
+
+#include <QString>
+#include <QVector>
+
+#include <asqlexports.h>
+
+class QObject;
+
+namespace ASql {
+
+class AStallRecord
+{
+public:
+    QString query;
+    QString tag;
+    qint64 elapsedUs = 0;
+    qint64 timestamp = 0;
+};
+
+/*!
+ * \brief The AStallMonitor class measures the time spent inside result and notification callbacks
+ *
+ * All callbacks are called from the connection's socket notifier, so a slow callback delays
+ * every other query running on the same thread. Once enabled each callback invocation is timed,
+ * the slowest ones are kept together with the query text and a call-site tag (the receiver
+ * class and object name, or the notification channel), and a warning is issued when a callback
+ * takes longer than the warning threshold.
+ *
+ * The monitor is disabled by default, in which case the overhead is a single atomic load.
+ */
+class ASQL_EXPORT AStallMonitor
+{
+public:
+    /*!
+     * \brief setEnabled enables or disables callback timing for all threads
+     * \param enabled
+     */
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    /*!
+     * \brief setWarningThreshold callbacks that take longer than \p usecs are logged
+     * with a warning on the "asql.stall" category, the default is 20ms.
+     *
+     * \param usecs
+     */
+    static void setWarningThreshold(qint64 usecs);
+    static qint64 warningThreshold();
+
+    /*!
+     * \brief setMaxRecords the number of worst offenders to keep, the default is 20.
+     * \param max
+     */
+    static void setMaxRecords(int max);
+
+    /*!
+     * \brief worstOffenders returns the slowest callbacks recorded so far, slowest first
+     * \return
+     */
+    static QVector<AStallRecord> worstOffenders();
+
+    /*!
+     * \brief reset clears all recorded callbacks
+     */
+    static void reset();
+
+    /*!
+     * \brief record registers a callback invocation, this is called by the drivers
+     * \param query
+     * \param tag
+     * \param elapsedNs
+     */
+    static void record(const QByteArray &query, const QString &tag, qint64 elapsedNs);
+
+    /*!
+     * \brief receiverTag returns a call-site tag describing \p receiver
+     * \param receiver
+     * \return
+     */
+    static QString receiverTag(const QObject *receiver);
+};
+
+}
+
+Q_DECLARE_TYPEINFO(ASql::AStallRecord, Q_MOVABLE_TYPE);
+
+#endif // ASTALLMONITOR_H
@@ -0,0 +1,529 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "atablemirror.h"
+
+#include "aresult.h"
+
+#include <QDateTime>
+#include <QSet>
+#include <QTimer>
+#include <QUuid>
+#include <QLoggingCategory>
+
+#include <algorithm>
+#include <numeric>
+
+Q_LOGGING_CATEGORY(ASQL_MIRROR, "asql.tablemirror", QtInfoMsg)
+
+namespace ASql {
+
+struct AMirrorIndex {
+    QString column;
+    ATableMirror::IndexType type;
+    int columnIndex = -1;
+    QMultiHash<QString, int> hash;
+    QVector<int> ordered;
+};
+
+class ATableMirrorPrivate
+{
+public:
+    QString keyText(const QVariant &value) const;
+    void rebuildIndexes();
+    void applyRows(AResult &result, const QSet<QString> &keys);
+    void refreshDirty(ATableMirror *q);
+    void connected(ATableMirror *q);
+
+    QString table;
+    QString keyColumn;
+    QString channel;
+    QString keyType;
+    ADatabase db;
+    QStringList columnNames;
+    QVector<QVariantList> rows;
+    QHash<QString, int> primary;
+    std::vector<AMirrorIndex> indexes;
+    QSet<QString> dirty;
+    int keyIndex = -1;
+    bool loaded = false;
+    bool loading = false;
+    bool refreshScheduled = false;
+    bool reloadPending = false;
+};
+
+}
+
+using namespace ASql;
+
+namespace {
+
+QString quoteIdentifier(const QString &identifier)
+{
+    QString ret = identifier;
+    ret.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + ret + QLatin1Char('"');
+}
+
+QString quoteTable(const QString &table)
+{
+    QStringList parts = table.split(QLatin1Char('.'));
+    for (QString &part : parts) {
+        part = quoteIdentifier(part);
+    }
+    return parts.join(QLatin1Char('.'));
+}
+
+QString quoteLiteral(const QString &value)
+{
+    QString ret = value;
+    ret.replace(QLatin1Char('\''), QLatin1String("''"));
+    return QLatin1Char('\'') + ret + QLatin1Char('\'');
+}
+
+QString channelName(const QString &table)
+{
+    QString ret = QLatin1String("asql_mirror_") + table.toLower();
+    ret.replace(QLatin1Char('.'), QLatin1Char('_'));
+    return ret;
+}
+
+bool isNumeric(const QVariant &value)
+{
+    switch (value.userType()) {
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Double:
+    case QMetaType::Float:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Orders values the way the database would for the types the driver
+ * returns, nulls first like NULLS FIRST
+ */
+bool variantLess(const QVariant &left, const QVariant &right)
+{
+    if (left.isNull() || right.isNull()) {
+        return left.isNull() && !right.isNull();
+    }
+
+    if (isNumeric(left) && isNumeric(right)) {
+        return left.toDouble() < right.toDouble();
+    }
+
+    switch (left.userType()) {
+    case QMetaType::QDateTime:
+        return left.toDateTime() < right.toDateTime();
+    case QMetaType::QDate:
+        return left.toDate() < right.toDate();
+    case QMetaType::QTime:
+        return left.toTime() < right.toTime();
+    default:
+        return left.toString() < right.toString();
+    }
+}
+
+}
+
+/*
+ * Keys are compared by their text so the QVariant type given by
+ * the caller doesn't need to match the one returned by the driver
+ */
+QString ATableMirrorPrivate::keyText(const QVariant &value) const
+{
+    if (value.userType() == QMetaType::QUuid) {
+        return value.toUuid().toString(QUuid::WithoutBraces);
+    }
+    return value.toString();
+}
+
+void ATableMirrorPrivate::rebuildIndexes()
+{
+    primary.clear();
+    primary.reserve(rows.size());
+    for (int i = 0; i < rows.size(); ++i) {
+        primary.insert(keyText(rows[i].value(keyIndex)), i);
+    }
+
+    for (AMirrorIndex &index : indexes) {
+        index.columnIndex = columnNames.indexOf(index.column);
+        index.hash.clear();
+        index.ordered.clear();
+        if (index.columnIndex == -1) {
+            qCWarning(ASQL_MIRROR) << "Indexed column not found" << table << index.column;
+            continue;
+        }
+
+        const int column = index.columnIndex;
+        if (index.type == ATableMirror::IndexType::Hash) {
+            index.hash.reserve(rows.size());
+            for (int i = 0; i < rows.size(); ++i) {
+                index.hash.insert(keyText(rows[i].value(column)), i);
+            }
+        } else {
+            index.ordered.resize(rows.size());
+            std::iota(index.ordered.begin(), index.ordered.end(), 0);
+            std::sort(index.ordered.begin(), index.ordered.end(), [this, column] (int a, int b) {
+                return variantLess(rows[a].value(column), rows[b].value(column));
+            });
+        }
+    }
+}
+
+void ATableMirrorPrivate::applyRows(AResult &result, const QSet<QString> &keys)
+{
+    QSet<QString> missing = keys;
+    for (auto row : result) {
+        QVariantList values = row.toList();
+        const QString key = keyText(values.value(keyIndex));
+        missing.remove(key);
+
+        auto it = primary.constFind(key);
+        if (it != primary.constEnd()) {
+            rows[it.value()] = values;
+        } else {
+            primary.insert(key, rows.size());
+            rows.append(values);
+        }
+    }
+
+    if (!missing.isEmpty()) {
+        // rows not returned were deleted, swap them with the last one to keep removal cheap
+        for (const QString &key : qAsConst(missing)) {
+            auto it = primary.find(key);
+            if (it == primary.end()) {
+                continue;
+            }
+
+            const int pos = it.value();
+            primary.erase(it);
+            const int last = rows.size() - 1;
+            if (pos != last) {
+                rows[pos] = rows[last];
+                primary[keyText(rows[pos].value(keyIndex))] = pos;
+            }
+            rows.removeLast();
+        }
+    }
+
+    rebuildIndexes();
+    qCDebug(ASQL_MIRROR) << "applied" << keys.size() << "changed keys" << table << rows.size();
+}
+
+void ATableMirrorPrivate::connected(ATableMirror *q)
+{
+    // Notifications sent while we were disconnected are lost
+    db.subscribeToNotification(channel, [this, q] (const ADatabaseNotification &notification) {
+        const QString key = notification.payload.toString();
+        if (key.isEmpty()) {
+            q->reload();
+            return;
+        }
+
+        dirty.insert(key);
+        if (!refreshScheduled) {
+            refreshScheduled = true;
+            // Coalesce all notifications already received into a single query
+            QTimer::singleShot(0, q, [this, q] {
+                refreshDirty(q);
+            });
+        }
+    }, q);
+    q->reload();
+}
+
+void ATableMirrorPrivate::refreshDirty(ATableMirror *q)
+{
+    refreshScheduled = false;
+    if (dirty.isEmpty() || loading || !loaded) {
+        return;
+    }
+
+    const QSet<QString> keys = dirty;
+    dirty.clear();
+
+    // Comparing the column with its own type allows the server to use the primary key index
+    QString query = QLatin1String("SELECT * FROM ") + quoteTable(table) + QLatin1String(" WHERE ") + quoteIdentifier(keyColumn);
+    if (!keyType.isEmpty()) {
+        query += QLatin1String(" = ANY($1::") + keyType + QLatin1String("[])");
+    } else {
+        query += QLatin1String("::text = ANY($1)");
+    }
+    db.exec(query, {QStringList(keys.values())}, [this, q, keys] (AResult &result) {
+        if (result.error()) {
+            // we can't tell what changed anymore
+            qCWarning(ASQL_MIRROR) << "Failed to fetch changed rows, reloading" << table << result.errorString();
+            q->reload();
+            return;
+        }
+
+        applyRows(result, keys);
+        Q_EMIT q->changed();
+    }, q);
+}
+
+ATableMirror::ATableMirror(const QString &table, const QString &keyColumn, QObject *parent) : QObject(parent)
+  , d_ptr(new ATableMirrorPrivate)
+{
+    Q_D(ATableMirror);
+    d->table = table;
+    d->keyColumn = keyColumn;
+    d->channel = channelName(table);
+}
+
+ATableMirror::~ATableMirror()
+{
+    delete d_ptr;
+}
+
+void ATableMirror::setDatabase(const ADatabase &db)
+{
+    Q_D(ATableMirror);
+    d->db = db;
+    d->db.onStateChanged([this] (ADatabase::State state, const QString &status) {
+        Q_D(ATableMirror);
+        if (state != ADatabase::State::Connected) {
+            qCDebug(ASQL_MIRROR) << "Mirror connection state" << d->table << int(state) << status;
+            return;
+        }
+        d->connected(this);
+    });
+
+    // An open connection won't report its state again, and one still connecting will
+    if (d->db.isOpen()) {
+        d->connected(this);
+    } else if (d->db.state() == ADatabase::State::Disconnected) {
+        d->db.open();
+    }
+}
+
+void ATableMirror::addIndex(const QString &column, IndexType type)
+{
+    Q_D(ATableMirror);
+    AMirrorIndex index;
+    index.column = column;
+    index.type = type;
+    d->indexes.push_back(index);
+    if (d->loaded) {
+        d->rebuildIndexes();
+    }
+}
+
+void ATableMirror::reload()
+{
+    Q_D(ATableMirror);
+    if (d->loading) {
+        d->reloadPending = true;
+        return;
+    }
+
+    d->loading = true;
+    d->reloadPending = false;
+    // Changes notified from now on are fetched after the full load
+    d->dirty.clear();
+
+    if (d->keyType.isEmpty()) {
+        // Sent before the load on the same connection, so it is known before any refresh
+        d->db.exec(u"SELECT format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = $1::regclass AND attname = $2",
+                   {quoteTable(d->table), d->keyColumn}, [this] (AResult &result) {
+            Q_D(ATableMirror);
+            if (!result.error() && result.size()) {
+                d->keyType = result.begin()[0].toString();
+            } else {
+                qCWarning(ASQL_MIRROR) << "Failed to find the key column type, comparing keys as text" << d->table << result.errorString();
+            }
+        }, this);
+    }
+
+    const QString query = QLatin1String("SELECT * FROM ") + quoteTable(d->table);
+    d->db.exec(query, [this] (AResult &result) {
+        Q_D(ATableMirror);
+        d->loading = false;
+        if (result.error()) {
+            qCWarning(ASQL_MIRROR) << "Failed to load table" << d->table << result.errorString();
+        } else {
+            d->columnNames = result.columnNames();
+            d->keyIndex = d->columnNames.indexOf(d->keyColumn);
+            if (d->keyIndex == -1) {
+                qCCritical(ASQL_MIRROR) << "Key column not found in table" << d->table << d->keyColumn;
+            }
+
+            d->rows.clear();
+            d->rows.reserve(result.size());
+            for (auto row : result) {
+                d->rows.append(row.toList());
+            }
+            d->rebuildIndexes();
+            d->loaded = true;
+            qCInfo(ASQL_MIRROR) << "Loaded table" << d->table << d->rows.size();
+            Q_EMIT changed();
+        }
+
+        if (d->reloadPending) {
+            reload();
+        } else if (!d->dirty.isEmpty()) {
+            d->refreshDirty(this);
+        }
+    }, this);
+}
+
+bool ATableMirror::isLoaded() const
+{
+    Q_D(const ATableMirror);
+    return d->loaded;
+}
+
+int ATableMirror::size() const
+{
+    Q_D(const ATableMirror);
+    return d->rows.size();
+}
+
+QString ATableMirror::channel() const
+{
+    Q_D(const ATableMirror);
+    return d->channel;
+}
+
+QStringList ATableMirror::columnNames() const
+{
+    Q_D(const ATableMirror);
+    return d->columnNames;
+}
+
+int ATableMirror::indexOfColumn(const QString &column) const
+{
+    Q_D(const ATableMirror);
+    return d->columnNames.indexOf(column);
+}
+
+QVariantList ATableMirror::row(const QVariant &key) const
+{
+    Q_D(const ATableMirror);
+    auto it = d->primary.constFind(d->keyText(key));
+    if (it != d->primary.constEnd()) {
+        return d->rows.at(it.value());
+    }
+    return {};
+}
+
+QVector<QVariantList> ATableMirror::find(const QString &column, const QVariant &value) const
+{
+    Q_D(const ATableMirror);
+    QVector<QVariantList> ret;
+    if (column == d->keyColumn) {
+        const QVariantList found = row(value);
+        if (!found.isEmpty()) {
+            ret.append(found);
+        }
+        return ret;
+    }
+
+    for (const AMirrorIndex &index : d->indexes) {
+        if (index.column == column && index.type == IndexType::Hash) {
+            const QString text = d->keyText(value);
+            auto it = index.hash.constFind(text);
+            while (it != index.hash.constEnd() && it.key() == text) {
+                ret.append(d->rows.at(it.value()));
+                ++it;
+            }
+            return ret;
+        }
+    }
+
+    qCWarning(ASQL_MIRROR) << "No hash index for column, scanning" << d->table << column;
+    const int columnIndex = d->columnNames.indexOf(column);
+    if (columnIndex != -1) {
+        const QString text = d->keyText(value);
+        for (const QVariantList &values : d->rows) {
+            if (d->keyText(values.value(columnIndex)) == text) {
+                ret.append(values);
+            }
+        }
+    }
+    return ret;
+}
+
+QVector<QVariantList> ATableMirror::range(const QString &column, const QVariant &from, const QVariant &to) const
+{
+    Q_D(const ATableMirror);
+    QVector<QVariantList> ret;
+    for (const AMirrorIndex &index : d->indexes) {
+        if (index.column != column || index.type != IndexType::Ordered || index.columnIndex == -1) {
+            continue;
+        }
+
+        const int columnIndex = index.columnIndex;
+        auto begin = index.ordered.constBegin();
+        if (!from.isNull()) {
+            begin = std::lower_bound(index.ordered.constBegin(), index.ordered.constEnd(), from,
+                                     [d, columnIndex] (int pos, const QVariant &value) {
+                return variantLess(d->rows.at(pos).value(columnIndex), value);
+            });
+        } else {
+            // nulls sort first and never match a range
+            while (begin != index.ordered.constEnd() && d->rows.at(*begin).value(columnIndex).isNull()) {
+                ++begin;
+            }
+        }
+
+        auto end = index.ordered.constEnd();
+        if (!to.isNull()) {
+            end = std::upper_bound(begin, index.ordered.constEnd(), to,
+                                   [d, columnIndex] (const QVariant &value, int pos) {
+                return variantLess(value, d->rows.at(pos).value(columnIndex));
+            });
+        }
+
+        ret.reserve(int(end - begin));
+        for (auto it = begin; it != end; ++it) {
+            ret.append(d->rows.at(*it));
+        }
+        return ret;
+    }
+
+    qCWarning(ASQL_MIRROR) << "No ordered index for column" << d->table << column;
+    return ret;
+}
+
+QString ATableMirror::triggerSql(const QString &table, const QString &keyColumn)
+{
+    const QString name = channelName(table);
+    const QString function = quoteIdentifier(name + QLatin1String("_notify"));
+    const QString quotedTable = quoteTable(table);
+    const QString args = quoteLiteral(name) + QLatin1String(", ") + quoteLiteral(keyColumn);
+
+    return QLatin1String("CREATE OR REPLACE FUNCTION ") + function + QLatin1String("() RETURNS trigger AS $$\n"
+"BEGIN\n"
+"    IF TG_LEVEL = 'STATEMENT' THEN\n"
+"        PERFORM pg_notify(TG_ARGV[0], '');\n"
+"        RETURN NULL;\n"
+"    END IF;\n"
+"    IF TG_OP <> 'INSERT' THEN\n"
+"        PERFORM pg_notify(TG_ARGV[0], to_jsonb(OLD) ->> TG_ARGV[1]);\n"
+"    END IF;\n"
+"    IF TG_OP <> 'DELETE' AND (TG_OP = 'INSERT' OR (to_jsonb(NEW) ->> TG_ARGV[1]) IS DISTINCT FROM (to_jsonb(OLD) ->> TG_ARGV[1])) THEN\n"
+"        PERFORM pg_notify(TG_ARGV[0], to_jsonb(NEW) ->> TG_ARGV[1]);\n"
+"    END IF;\n"
+"    RETURN NULL;\n"
+"END;\n"
+"$$ LANGUAGE plpgsql;\n"
+"DROP TRIGGER IF EXISTS asql_mirror ON ") + quotedTable + QLatin1String(";\n"
+"CREATE TRIGGER asql_mirror AFTER INSERT OR UPDATE OR DELETE ON ") + quotedTable +
+            QLatin1String(" FOR EACH ROW EXECUTE FUNCTION ") + function + QLatin1Char('(') + args + QLatin1String(");\n"
+"DROP TRIGGER IF EXISTS asql_mirror_truncate ON ") + quotedTable + QLatin1String(";\n"
+"CREATE TRIGGER asql_mirror_truncate AFTER TRUNCATE ON ") + quotedTable +
+            QLatin1String(" FOR EACH STATEMENT EXECUTE FUNCTION ") + function + QLatin1Char('(') + args + QLatin1String(");\n");
+}
+
+#include "moc_atablemirror.cpp"
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: (C) 2022 Daniel Nicoletti <dantti12@gmail.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ATABLEMIRROR_H
+#define ATABLEMIRROR_H
+
+#include <QObject>
+#include <QVector>
+
+#include <adatabase.h>
+
+#include <asqlexports.h>
+
+namespace ASql {
+
+class ATableMirrorPrivate;
+
+/*!
+ * \brief The ATableMirror class keeps an in-memory copy of a small table
+ *
+ * The table is loaded once and kept up to date through notifications sent by the trigger
+ * created with the SQL returned by triggerSql(), lookups are then answered from local
+ * indexes without any round trip, which suits hot reference tables like permissions
+ * or configuration.
+ *
+ * The mirror needs a dedicated connection, it takes the \sa ADatabase::onStateChanged()
+ * callback to subscribe and reload everything whenever the connection is (re)established,
+ * as notifications sent while disconnected are lost.
+ *
+ * \code{.cpp}
+ * auto mirror = new ATableMirror(QStringLiteral("permissions"), QStringLiteral("id"), this);
+ * mirror->addIndex(QStringLiteral("role_id"));
+ * mirror->setDatabase(ADatabase(factory));
+ * connect(mirror, &ATableMirror::changed, this, [=] {
+ *     const auto rows = mirror->find(QStringLiteral("role_id"), 5);
+ * });
+ * \endcode
+ */
+class ASQL_EXPORT ATableMirror : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(ATableMirror)
+public:
+    enum class IndexType {
+        Hash,
+        Ordered,
+    };
+    Q_ENUM(IndexType)
+
+    /*!
+     * \brief ATableMirror constructs a mirror of \p table
+     * \param table the table name, it may be schema qualified
+     * \param keyColumn the primary key column
+     * \param parent
+     */
+    explicit ATableMirror(const QString &table, const QString &keyColumn, QObject *parent = nullptr);
+    virtual ~ATableMirror();
+
+    /*!
+     * \brief setDatabase sets the dedicated connection and loads the table once it's connected
+     * \param db
+     */
+    void setDatabase(const ADatabase &db);
+
+    /*!
+     * \brief addIndex indexes \p column, Hash indexes answer find() and Ordered ones range()
+     * \param column
+     * \param type
+     */
+    void addIndex(const QString &column, IndexType type = IndexType::Hash);
+
+    /*!
+     * \brief reload fetches all rows again
+     */
+    void reload();
+
+    bool isLoaded() const;
+    int size() const;
+    QString channel() const;
+    QStringList columnNames() const;
+    int indexOfColumn(const QString &column) const;
+
+    /*!
+     * \brief row returns the row with \p key, or an empty list if it doesn't exist
+     */
+    QVariantList row(const QVariant &key) const;
+
+    /*!
+     * \brief find returns the rows where \p column equals \p value, using a Hash index
+     */
+    QVector<QVariantList> find(const QString &column, const QVariant &value) const;
+
+    /*!
+     * \brief range returns the rows where \p column is between \p from and \p to inclusive,
+     * ordered by \p column, using an Ordered index
+     *
+     * A null \p from or \p to leaves that side of the range open.
+     */
+    QVector<QVariantList> range(const QString &column, const QVariant &from, const QVariant &to) const;
+
+    /*!
+     * \brief triggerSql returns the SQL that creates the trigger notifying changes of \p table
+     *
+     * Every changed key is sent as payload on channel(), changes are committed before the
+     * notification is delivered, truncating the table sends an empty payload which reloads it.
+     */
+    static QString triggerSql(const QString &table, const QString &keyColumn);
+
+Q_SIGNALS:
+    /*!
+     * \brief changed is emitted after the table was loaded or changed rows were applied
+     */
+    void changed();
+
+private:
+    ATableMirrorPrivate *d_ptr;
+};
+
+}
+
+#endif // ATABLEMIRROR_H